@@ -25,25 +25,38 @@
 #include "internal.h"
 #include "crypto_backend.h"
 
+/*
+ * Round i hashes i 'A' characters followed by passphrase (hack from hashalot
+ * to avoid null bytes in key). All rounds share one buffer, the 'A' prefix
+ * of the longest round precedes passphrase and every round hashes its tail,
+ * so each round is a single hash write (one syscall for kernel backend).
+ */
 static int hash(const char *hash_name, size_t key_size, char *key,
 		size_t passphrase_size, const char *passphrase)
 {
 	struct crypt_hash *md = NULL;
-	size_t len;
-	int round, i, r = 0;
+	size_t len, rounds, buf_size;
+	char *buf;
+	int round, r = 0;
 
 	if (crypt_hash_init(&md, hash_name))
 		return -ENOENT;
 
 	len = crypt_hash_size(hash_name);
+	rounds = key_size ? (key_size - 1) / len + 1 : 0;
 
-	for(round = 0; key_size && !r; round++) {
-		/* hack from hashalot to avoid null bytes in key */
-		for(i = 0; i < round; i++)
-			if (crypt_hash_write(md, "A", 1))
-				r = 1;
+	buf_size = (rounds ? rounds - 1 : 0) + passphrase_size;
+	buf = crypt_safe_alloc(buf_size ?: 1);
+	if (!buf) {
+		crypt_hash_destroy(md);
+		return -ENOMEM;
+	}
+	memset(buf, 'A', buf_size - passphrase_size);
+	memcpy(buf + buf_size - passphrase_size, passphrase, passphrase_size);
 
-		if (crypt_hash_write(md, passphrase, passphrase_size))
+	for(round = 0; key_size && !r; round++) {
+		if (crypt_hash_write(md, buf + buf_size - passphrase_size - round,
+				     passphrase_size + round))
 			r = 1;
 
 		if (len > key_size)
@@ -56,6 +69,7 @@ static int hash(const char *hash_name, size_t key_size, char *key,
 		key_size -= len;
 	}
 
+	crypt_safe_free(buf);
 	crypt_hash_destroy(md);
 	return r;
 }
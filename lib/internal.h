@@ -9,11 +9,13 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "nls.h"
 #include "utils_crypt.h"
 #include "utils_loop.h"
 #include "utils_dm.h"
+#include "utils_probe.h"
 
 #define SECTOR_SHIFT		9
 #define SECTOR_SIZE		(1 << SECTOR_SHIFT)
@@ -41,6 +43,13 @@ struct volume_key *crypt_generate_volume_key(struct crypt_device *cd, unsigned k
 void crypt_free_volume_key(struct volume_key *vk);
 
 int crypt_confirm(struct crypt_device *cd, const char *msg);
+void *crypt_workspace(struct crypt_device *cd, size_t size);
+int init_crypto(struct crypt_device *ctx);
+
+void crypt_timing_start(struct crypt_device *cd, struct timespec *start);
+void crypt_timing_end(struct crypt_device *cd, const struct timespec *start,
+		      const char *phase, int keyslot,
+		      uint64_t bytes_read, uint64_t bytes_written);
 
 void set_error_va(const char *fmt, va_list va);
 void set_error(const char *fmt, ...);
@@ -56,6 +65,7 @@ ssize_t read_blockwise(int fd, void *_buf, size_t count);
 ssize_t write_lseek_blockwise(int fd, char *buf, size_t count, off_t offset);
 int device_ready(struct crypt_device *cd, const char *device, int mode);
 int device_size(const char *device, uint64_t *size);
+int device_is_image_file(const char *device);
 
 enum devcheck { DEV_OK = 0, DEV_EXCL = 1, DEV_SHARED = 2 };
 int device_check_and_adjust(struct crypt_device *cd,
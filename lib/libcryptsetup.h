@@ -107,6 +107,40 @@ void crypt_set_password_callback(struct crypt_device *cd,
 	int (*password)(const char *msg, char *buf, size_t length, void *usrptr),
 	void *usrptr);
 
+/**
+ * Timing of one phase of library operation.
+ *
+ * @phase - phase name, e.g. "pbkdf2", "keyslot_map", "keyslot_read",
+ *          "af_merge", "verify", "header_read" or "activate";
+ *          "dm_remove_busy" is time spent waiting for another process
+ *          (usually udev) to close a device before it can be removed
+ * @keyslot - keyslot the phase belongs to or -1
+ * @usec - duration of phase in microseconds (monotonic clock)
+ * @bytes_read - bytes read from device during phase
+ * @bytes_written - bytes written to device during phase
+ */
+struct crypt_timing {
+	const char *phase;
+	int keyslot;
+	uint64_t usec;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+};
+
+/**
+ * Set operation timing callback.
+ *
+ * Callback is called after every finished phase of unlock, format
+ * and keyslot operations, phases are reported in order of execution.
+ *
+ * @cd - crypt device handle
+ * @timing - timing of finished phase (valid only during callback)
+ * @usrptr - provided identification in callback
+ */
+void crypt_set_timing_callback(struct crypt_device *cd,
+	void (*timing)(const struct crypt_timing *timing, void *usrptr),
+	void *usrptr);
+
 /**
  * Various crypt device parameters
  *
@@ -241,6 +275,36 @@ int crypt_load(struct crypt_device *cd,
 	       const char *requested_type,
 	       void *params);
 
+/**
+ * LUKS1 header probe result
+ */
+struct crypt_probe_luks1 {
+	char uuid[40];		/* UUID string */
+	char cipher[32];	/* cipher name, e.g. "aes" */
+	char cipher_mode[32];	/* cipher mode including IV, e.g. "xts-plain64" */
+	char hash[32];		/* hash used in LUKS header */
+	size_t volume_key_size;	/* size of volume key in bytes */
+	uint64_t data_offset;	/* data offset in sectors */
+};
+
+/**
+ * Probe device or image file for LUKS1 header without crypt device handle
+ *
+ * Returns 0 if LUKS1 header was found, -EINVAL if there is no LUKS1 header,
+ * -EBUSY if the header is marked by interrupted online reencryption
+ * (@probe is filled as well) or other negative errno value otherwise.
+ *
+ * @device - path to device or image file
+ * @probe - preallocated probe result to fill or NULL for signature check only
+ *
+ * Note that only the first sector is read (one pread call), neither
+ * device-mapper nor random number generator is initialised and no global
+ * state is used, so many devices can be probed concurrently.
+ * Probe does not validate that hash from header is supported,
+ * use crypt_load() for full header check.
+ */
+int crypt_probe_luks1(const char *device, struct crypt_probe_luks1 *probe);
+
 /**
  * Resize crypt device
  *
@@ -265,6 +329,56 @@ int crypt_resize(struct crypt_device *cd,
 int crypt_suspend(struct crypt_device *cd,
 		  const char *name);
 
+/**
+ * Online reencryption parameters
+ */
+struct crypt_params_reencrypt {
+	struct crypt_device *cd_new;	/* handle with the new header loaded */
+	const char *volume_key;		/* old (active) volume key */
+	size_t volume_key_size;
+	const char *new_volume_key;	/* volume key of the new header */
+	size_t new_volume_key_size;
+};
+
+/**
+ * Switch segments of active LUKS device during online reencryption
+ *
+ * Sectors below @offset are mapped with the new header parameters,
+ * sectors from @offset to @offset + @length through a hotzone device
+ * and the rest still with the old volume key.
+ * With @offset equal to device size and zero @length the device
+ * is switched completely to the new volume key and hotzone is removed.
+ *
+ * Returns 0 on success or negative errno value otherwise.
+ *
+ * @cd - crypt device handle with the old header
+ * @name - name of active device
+ * @params - new header and both volume keys
+ * @offset - reencrypted area size in sectors
+ * @length - hotzone size in sectors
+ *
+ * Note that both volume keys are verified only in the first call,
+ * the first call must use zero @offset or @offset equal to device size.
+ */
+int crypt_reencrypt_segments(struct crypt_device *cd,
+			     const char *name,
+			     struct crypt_params_reencrypt *params,
+			     uint64_t offset,
+			     uint64_t length);
+
+/**
+ * Suspend hotzone device before its data are rewritten
+ *
+ * Only I/O to the hotzone is blocked until the next call
+ * of crypt_reencrypt_segments().
+ *
+ * Returns 0 on success or negative errno value otherwise.
+ *
+ * @cd - crypt device handle
+ * @name - name of active device
+ */
+int crypt_reencrypt_hotzone_suspend(struct crypt_device *cd, const char *name);
+
 /**
  * Resumes crypt device using passphrase.
  *
@@ -395,6 +509,8 @@ int crypt_keyslot_destroy(struct crypt_device *cd, int keyslot);
 #define CRYPT_ACTIVATE_NO_UUID  (1 << 1) /* ignored */
 #define CRYPT_ACTIVATE_SHARED   (1 << 2)
 #define CRYPT_ACTIVATE_ALLOW_DISCARDS (1 << 3) /* enable discards aka TRIM */
+#define CRYPT_ACTIVATE_PRIVATE (1 << 4) /* private mapping hidden from udev (LUKS only),
+					 * with SHARED skips exclusive device check */
 
 /**
  * Active device runtime attributes
@@ -419,6 +535,52 @@ int crypt_get_active_device(struct crypt_device *cd,
 			    const char *name,
 			    struct crypt_active_device *cad);
 
+/**
+ * Active device managed by cryptsetup
+ *
+ * @name - device-mapper name of active device
+ * @uuid - device-mapper UUID, without "CRYPT-" prefix
+ * @type - device type from UUID (PLAIN, LUKS1, LOOPAES or TEMP
+ *         for temporary-cryptsetup-<pid> devices)
+ * @device_major, @device_minor - backing device number
+ * @offset, @iv_offset, @size, @flags - see struct crypt_active_device
+ *
+ * Device without crypt target (e.g. temporary device replaced by error
+ * target) has only name, uuid and type set.
+ */
+struct crypt_active_entry {
+	char *name;
+	char *uuid;
+	char type[16];
+	uint32_t device_major;
+	uint32_t device_minor;
+	uint64_t offset;
+	uint64_t iv_offset;
+	uint64_t size;
+	uint32_t flags;
+};
+
+/**
+ * List all active devices with cryptsetup UUID
+ *
+ * Devices are found by one device-mapper list call and each is read by
+ * one table query, so listing is much cheaper than crypt_init_by_name()
+ * and crypt_get_active_device() for every device.
+ *
+ * Returns number of listed devices or negative errno value otherwise.
+ *
+ * @list - allocated array of devices, release with crypt_free_active_list()
+ */
+int crypt_list_active(struct crypt_active_entry **list);
+
+/**
+ * Release list allocated by crypt_list_active()
+ *
+ * @list - list of devices
+ * @count - number of devices in list
+ */
+void crypt_free_active_list(struct crypt_active_entry *list, int count);
+
 /**
  * Activate device or check passphrase
  *
@@ -547,6 +709,15 @@ crypt_status_info crypt_status(struct crypt_device *cd, const char *name);
  */
 int crypt_dump(struct crypt_device *cd);
 
+/**
+ * Dump information about crypt device to log output as one JSON object
+ *
+ * Returns 0 on success or negative errno value otherwise.
+ *
+ * @cd - crypt device handle
+ */
+int crypt_dump_json(struct crypt_device *cd);
+
 /**
  * Various crypt device info functions
  *
@@ -610,6 +781,78 @@ int crypt_header_restore(struct crypt_device *cd,
 	const char *requested_type,
 	const char *backup_file);
 
+/**
+ * Informational benchmark for ciphers
+ *
+ * Returns 0 on success, -ENOTSUP if kernel userspace crypto API
+ * is not available, -ENOENT if cipher is not available
+ * or negative errno value otherwise.
+ *
+ * @cd - crypt device handle, can be NULL
+ * @cipher - cipher name, e.g. "aes"
+ * @cipher_mode - cipher mode, e.g. "xts-plain64" (IV generator is ignored)
+ * @volume_key_size - size of volume key in bytes
+ * @buffer_size - size of encryption buffer in bytes used in test
+ * @encryption_mbs - measured encryption speed in MiB/s
+ * @decryption_mbs - measured decryption speed in MiB/s
+ *
+ * Note that the test uses memory only (no storage IO) and the same
+ * kernel cipher implementation as dm-crypt.
+ * IV size is the cipher block size, ECB mode uses no IV.
+ */
+int crypt_benchmark(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	size_t buffer_size,
+	double *encryption_mbs,
+	double *decryption_mbs);
+
+/**
+ * Informational benchmark for key derivation function
+ *
+ * Returns 0 on success or negative errno value otherwise.
+ *
+ * @cd - crypt device handle, can be NULL
+ * @kdf - key derivation function, only "pbkdf2" is supported
+ * @hash - hash used in kdf, e.g. "sha1"
+ * @iterations_sec - measured iterations per second
+ */
+int crypt_benchmark_kdf(struct crypt_device *cd,
+	const char *kdf,
+	const char *hash,
+	uint64_t *iterations_sec);
+
+/**
+ * Kernel dm-crypt target capabilities
+ */
+#define CRYPT_KERNEL_KEY_WIPE	(1 << 0) /* key wipe message (suspend/resume) */
+#define CRYPT_KERNEL_LMK	(1 << 1) /* lmk IV (loop-AES compatible mode) */
+#define CRYPT_KERNEL_SECURE	(1 << 2) /* ioctl buffers with keys are wiped */
+#define CRYPT_KERNEL_PLAIN64	(1 << 3) /* plain64 IV */
+#define CRYPT_KERNEL_DISCARDS	(1 << 4) /* discards (TRIM) can be allowed */
+
+/**
+ * Get capabilities of kernel dm-crypt target
+ *
+ * Returns 0 on success, -ENOTSUP if dm-crypt target is not (yet) loaded
+ * or negative errno value otherwise.
+ *
+ * @flags - returns CRYPT_KERNEL_* flags
+ *
+ * Note that the result is cached process-wide and shared by all crypt device
+ * handles, kernel is queried again only after crypt_invalidate_kernel_flags().
+ */
+int crypt_get_kernel_flags(uint32_t *flags);
+
+/**
+ * Drop cached kernel dm-crypt capabilities
+ *
+ * Use it if dm-crypt module was reloaded (e.g. after kernel module update),
+ * next operation then queries kernel again.
+ */
+void crypt_invalidate_kernel_flags(void);
+
 /**
  * Receives last reported error
  *
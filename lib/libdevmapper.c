@@ -20,10 +20,13 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <dirent.h>
 #include <errno.h>
+#include <signal.h>
 #include <libdevmapper.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <linux/fs.h>
 #include <uuid/uuid.h>
 
@@ -34,7 +37,12 @@
 #define DM_UUID_PREFIX		"CRYPT-"
 #define DM_UUID_PREFIX_LEN	6
 #define DM_CRYPT_TARGET		"crypt"
-#define RETRY_COUNT		5
+#define DM_LINEAR_TARGET	"linear"
+
+/* Busy device removal, wait time is doubled after every attempt */
+#define REMOVE_TIMEOUT_MS	4000
+#define REMOVE_WAIT_MIN_MS	5
+#define REMOVE_WAIT_MAX_MS	250
 
 /* Set if dm-crypt version was probed */
 static int _dm_crypt_checked = 0;
@@ -50,11 +58,28 @@ static int dm_task_secure_data(struct dm_task *dmt) { return 1; }
 
 /* Compatibility for old device-mapper without udev support */
 #if HAVE_DECL_DM_UDEV_DISABLE_DISK_RULES_FLAG
+/*
+ * Disabled disk rules skip blkid scan of the device, low priority flag
+ * only makes its symlinks lose to any other device claiming the same name.
+ */
+#ifndef DM_UDEV_LOW_PRIORITY_FLAG
+#define DM_UDEV_LOW_PRIORITY_FLAG 0
+#endif
 #define CRYPT_TEMP_UDEV_FLAGS	DM_UDEV_DISABLE_SUBSYSTEM_RULES_FLAG | \
 				DM_UDEV_DISABLE_DISK_RULES_FLAG | \
-				DM_UDEV_DISABLE_OTHER_RULES_FLAG
+				DM_UDEV_DISABLE_OTHER_RULES_FLAG | \
+				DM_UDEV_LOW_PRIORITY_FLAG
 #define _dm_task_set_cookie	dm_task_set_cookie
-#define _dm_udev_wait		dm_udev_wait
+static int _dm_udev_wait(uint32_t cookie)
+{
+	int r;
+
+	crypt_probe1(udev__wait__start, cookie);
+	r = dm_udev_wait(cookie);
+	crypt_probe2(udev__wait__done, cookie, r);
+
+	return r;
+}
 #else
 #define CRYPT_TEMP_UDEV_FLAGS	0
 static int _dm_task_set_cookie(struct dm_task *dmt, uint32_t *cookie, uint16_t flags) { return 0; }
@@ -92,6 +117,8 @@ static void set_dm_error(int level,
 }
 
 static int _dm_simple(int task, const char *name, int udev_wait);
+static int _dm_simple_flags(int task, const char *name, int udev_wait,
+			    uint16_t udev_flags);
 
 static void _dm_set_crypt_compat(const char *dm_version, unsigned crypt_maj,
 				 unsigned crypt_min, unsigned crypt_patch)
@@ -166,6 +193,10 @@ static int _dm_check_versions(void)
 	return 1;
 }
 
+/*
+ * Flags are cached process-wide, kernel is queried only until dm-crypt
+ * target version is known (or again after explicit invalidation).
+ */
 uint32_t dm_flags(void)
 {
 	if (!_dm_crypt_checked)
@@ -174,11 +205,23 @@ uint32_t dm_flags(void)
 	return _dm_crypt_flags;
 }
 
+int dm_flags_checked(void)
+{
+	return _dm_crypt_checked;
+}
+
+void dm_flags_invalidate(void)
+{
+	log_dbg("Dropping cached dm-crypt kernel flags.");
+	_dm_crypt_checked = 0;
+	_dm_crypt_flags = 0;
+}
+
 int dm_init(struct crypt_device *context, int check_kernel)
 {
 	if (!_dm_use_count++) {
 		log_dbg("Initialising device-mapper backend%s, UDEV is %sabled.",
-			check_kernel ? "" : " (NO kernel check requested)",
+			check_kernel ? "" : " (kernel check deferred)",
 			_dm_use_udev() ? "en" : "dis");
 		if (check_kernel && !_dm_check_versions()) {
 			log_err(context, _("Cannot initialize device-mapper. Is dm_mod kernel module loaded?\n"));
@@ -197,8 +240,12 @@ int dm_init(struct crypt_device *context, int check_kernel)
 	return 1;	/* unsafe memory */
 }
 
-void dm_exit(void)
+void dm_exit(struct crypt_device *context)
 {
+	/* Context is being released, never log through freed handle */
+	if (context && context == _context)
+		_context = NULL;
+
 	if (_dm_use_count && (!--_dm_use_count)) {
 		log_dbg("Releasing device-mapper backend.");
 		dm_log_init_verbose(0);
@@ -278,8 +325,28 @@ out:
 	return params;
 }
 
+static char *get_linear_params(const char *device, uint64_t offset)
+{
+	int r, max_size;
+	char *params;
+
+	max_size = strlen(device) + 32;
+	params = crypt_safe_alloc(max_size);
+	if (!params)
+		return NULL;
+
+	r = snprintf(params, max_size, "%s %" PRIu64, device, offset);
+	if (r < 0 || r >= max_size) {
+		crypt_safe_free(params);
+		params = NULL;
+	}
+
+	return params;
+}
+
 /* DM helpers */
-static int _dm_simple(int task, const char *name, int udev_wait)
+static int _dm_simple_flags(int task, const char *name, int udev_wait,
+			    uint16_t udev_flags)
 {
 	int r = 0;
 	struct dm_task *dmt;
@@ -294,7 +361,7 @@ static int _dm_simple(int task, const char *name, int udev_wait)
 	if (name && !dm_task_set_name(dmt, name))
 		goto out;
 
-	if (udev_wait && !_dm_task_set_cookie(dmt, &cookie, 0))
+	if (udev_wait && !_dm_task_set_cookie(dmt, &cookie, udev_flags))
 		goto out;
 
 	r = dm_task_run(dmt);
@@ -307,6 +374,29 @@ static int _dm_simple(int task, const char *name, int udev_wait)
 	return r;
 }
 
+static int _dm_simple(int task, const char *name, int udev_wait)
+{
+	return _dm_simple_flags(task, name, udev_wait, 0);
+}
+
+/* Returns open count of device, negative errno if it cannot be read */
+static int _dm_open_count(const char *name)
+{
+	struct dm_task *dmt;
+	struct dm_info dmi;
+	int r = -EINVAL;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_INFO)))
+		return -EINVAL;
+
+	if (dm_task_set_name(dmt, name) && dm_task_run(dmt) &&
+	    dm_task_get_info(dmt, &dmi))
+		r = dmi.exists ? dmi.open_count : -ENODEV;
+
+	dm_task_destroy(dmt);
+	return r;
+}
+
 static int _error_device(const char *name, size_t size)
 {
 	struct dm_task *dmt;
@@ -330,7 +420,7 @@ static int _error_device(const char *name, size_t size)
 	if (!dm_task_run(dmt))
 		goto error;
 
-	if (!_dm_simple(DM_DEVICE_RESUME, name, 1)) {
+	if (!_dm_simple_flags(DM_DEVICE_RESUME, name, 1, CRYPT_TEMP_UDEV_FLAGS)) {
 		_dm_simple(DM_DEVICE_CLEAR, name, 0);
 		goto error;
 	}
@@ -342,49 +432,236 @@ error:
 	return r;
 }
 
-int dm_remove_device(const char *name, int force, uint64_t size)
+/*
+ * Busy device (usually opened by udev/blkid scan) is polled with short
+ * exponentially growing waits, the whole wait is reported as
+ * "dm_remove_busy" phase through timing callback of cd.
+ */
+int dm_remove_device(struct crypt_device *cd, const char *name, int force, uint64_t size)
 {
-	int r = -EINVAL;
-	int retries = force ? RETRY_COUNT : 1;
-	int error_target = 0;
+	struct timespec start;
+	unsigned int wait_ms = REMOVE_WAIT_MIN_MS, waited_ms = 0, tries = 1;
+	uint16_t udev_flags = force ? CRYPT_TEMP_UDEV_FLAGS : 0;
+	int r, error_target = 0;
 
 	if (!name || (force && !size))
 		return -EINVAL;
 
-	do {
-		r = _dm_simple(DM_DEVICE_REMOVE, name, 1) ? 0 : -EINVAL;
-		if (--retries && r) {
-			log_dbg("WARNING: other process locked internal device %s, %s.",
-				name, retries ? "retrying remove" : "giving up");
-			if (force && (crypt_get_debug_level() == CRYPT_LOG_DEBUG))
-				debug_processes_using_device(name);
-			sleep(1);
-			if (force && !error_target) {
-				/* If force flag is set, replace device with error, read-only target.
-				 * it should stop processes from reading it and also removed underlying
-				 * device from mapping, so it is usable again.
-				 * Force flag should be used only for temporary devices, which are
-				 * intended to work inside cryptsetup only!
-				 * Anyway, if some process try to read temporary cryptsetup device,
-				 * it is bug - no other process should try touch it (e.g. udev).
-				 */
-				_error_device(name, size);
-				error_target = 1;
-			}
+	crypt_probe1(dm__remove, name);
+	r = _dm_simple_flags(DM_DEVICE_REMOVE, name, 1, udev_flags) ? 0 : -EINVAL;
+	if (!r || !force)
+		goto out;
+
+	log_dbg("WARNING: other process locked internal device %s, waiting.", name);
+	if (crypt_get_debug_level() == CRYPT_LOG_DEBUG)
+		debug_processes_using_device(name);
+
+	crypt_timing_start(cd, &start);
+	while (r && waited_ms < REMOVE_TIMEOUT_MS) {
+		if (!error_target) {
+			/* If force flag is set, replace device with error, read-only target.
+			 * it should stop processes from reading it and also removed underlying
+			 * device from mapping, so it is usable again.
+			 * Force flag should be used only for temporary devices, which are
+			 * intended to work inside cryptsetup only!
+			 * Anyway, if some process try to read temporary cryptsetup device,
+			 * it is bug - no other process should try touch it (e.g. udev).
+			 */
+			_error_device(name, size);
+			error_target = 1;
 		}
-	} while (r == -EINVAL && retries);
 
+		/* Do not try to remove device until the last opener closes it */
+		do {
+			usleep(wait_ms * 1000);
+			waited_ms += wait_ms;
+			if ((wait_ms *= 2) > REMOVE_WAIT_MAX_MS)
+				wait_ms = REMOVE_WAIT_MAX_MS;
+		} while (_dm_open_count(name) > 0 && waited_ms < REMOVE_TIMEOUT_MS);
+
+		r = _dm_simple_flags(DM_DEVICE_REMOVE, name, 1, udev_flags) ? 0 : -EINVAL;
+		tries++;
+		crypt_probe3(dm__remove__busy, name, tries, waited_ms);
+	}
+	crypt_timing_end(cd, &start, "dm_remove_busy", -1, 0, 0);
+
+	log_dbg("Device %s %sremoved after %u attempts, %u ms wait.",
+		name, r ? "not " : "", tries, waited_ms);
+out:
 	dm_task_update_nodes();
+	crypt_probe2(dm__remove__done, name, r);
 
 	return r;
 }
 
+#if HAVE_DECL_DM_TASK_DEFERRED_REMOVE
+/* Kernel removes device when the last opener closes it */
+static int _dm_deferred_remove(const char *name)
+{
+	struct dm_task *dmt;
+	int r = 0;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_REMOVE)))
+		return 0;
+
+	if (dm_task_set_name(dmt, name) && dm_task_deferred_remove(dmt))
+		r = dm_task_run(dmt);
+
+	dm_task_destroy(dmt);
+	return r;
+}
+#else
+static int _dm_deferred_remove(const char *name) { return 0; }
+#endif
+
+/*
+ * Remove temporary device without sleeping while some other process
+ * (udev, blkid) keeps it open. The busy device is switched to error target,
+ * so the opener gets only I/O errors and the underlying device is released,
+ * then the removal is deferred to the kernel. Old kernels without deferred
+ * remove fall back to dm_remove_device() retries.
+ */
+int dm_remove_temp_device(struct crypt_device *cd, const char *name, uint64_t size)
+{
+	struct timespec start;
+	int r;
+
+	if (!name || !size)
+		return -EINVAL;
+
+	crypt_probe1(dm__remove, name);
+
+	r = _dm_simple_flags(DM_DEVICE_REMOVE, name, 1, CRYPT_TEMP_UDEV_FLAGS) ? 0 : -EINVAL;
+	if (r < 0) {
+		log_dbg("Temporary device %s is busy, replacing it with error target.", name);
+		if (crypt_get_debug_level() == CRYPT_LOG_DEBUG)
+			debug_processes_using_device(name);
+
+		crypt_timing_start(cd, &start);
+		if (_error_device(name, size) &&
+		    _dm_simple_flags(DM_DEVICE_REMOVE, name, 1, CRYPT_TEMP_UDEV_FLAGS))
+			r = 0;
+		else if (_dm_deferred_remove(name)) {
+			log_dbg("Removal of temporary device %s deferred.", name);
+			r = 0;
+		}
+		crypt_timing_end(cd, &start, "dm_remove_busy", -1, 0, 0);
+	}
+
+	dm_task_update_nodes();
+	crypt_probe2(dm__remove__done, name, r);
+
+	if (r < 0)
+		r = dm_remove_device(cd, name, 1, size);
+
+	return r;
+}
+
+/*
+ * PID namespace of this process, temporary devices carry it in UUID.
+ * Device-mapper names are global, PID is meaningful only in its namespace.
+ */
+static unsigned long long _dm_pid_ns(void)
+{
+	static unsigned long long pid_ns = 0;
+	struct stat st;
+
+	if (!pid_ns && !stat("/proc/self/ns/pid", &st))
+		pid_ns = (unsigned long long)st.st_ino;
+
+	return pid_ns;
+}
+
+/* Remove unused temporary device, returns 1 if removed */
+static int _dm_remove_stale(const char *name, const char *uuid_prefix)
+{
+	struct dm_task *dmt;
+	struct dm_info dmi;
+	const char *uuid;
+	int stale = 0;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_INFO)))
+		return 0;
+
+	if (dm_task_set_name(dmt, name) && dm_task_run(dmt) &&
+	    dm_task_get_info(dmt, &dmi) && dmi.exists && !dmi.open_count &&
+	    (uuid = dm_task_get_uuid(dmt)) &&
+	    !strncmp(uuid, uuid_prefix, strlen(uuid_prefix)))
+		stale = 1;
+
+	dm_task_destroy(dmt);
+
+	if (!stale)
+		return 0;
+
+	log_dbg("Removing stale temporary device %s.", name);
+	return _dm_simple_flags(DM_DEVICE_REMOVE, name, 1, CRYPT_TEMP_UDEV_FLAGS);
+}
+
+/*
+ * Temporary devices are named <prefix><pid>-<seq>. Remove devices left behind
+ * by processes which no longer exist (e.g. killed by SIGKILL).
+ * Only devices created in the same PID namespace are checked,
+ * device still open by somebody is never touched.
+ */
+void dm_remove_stale_temp_devices(const char *prefix)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	unsigned int next = 0;
+	size_t len = strlen(prefix);
+	char uuid_prefix[64], *seq, *end;
+	long pid;
+	int removed = 0;
+
+	/* Without namespace we cannot tell whose PID it is */
+	if (!_dm_pid_ns()) {
+		log_dbg("PID namespace unknown, stale temporary devices are kept.");
+		return;
+	}
+	snprintf(uuid_prefix, sizeof(uuid_prefix), DM_UUID_PREFIX "TEMP-%llu-",
+		 _dm_pid_ns());
+
+	if (!(dmt = dm_task_create(DM_DEVICE_LIST)))
+		return;
+
+	if (!dm_task_run(dmt) || !(names = dm_task_get_names(dmt)) || !names->dev)
+		goto out;
+
+	do {
+		names = (struct dm_names *)((char *)names + next);
+		next = names->next;
+
+		if (strncmp(names->name, prefix, len))
+			continue;
+
+		pid = strtol(names->name + len, &end, 10);
+		if (*end != '-' || pid <= 0 || pid == getpid())
+			continue;
+
+		seq = end + 1;
+		strtoul(seq, &end, 10);
+		if (end == seq || *end)
+			continue;
+
+		if (!kill((pid_t)pid, 0) || errno != ESRCH)
+			continue;
+
+		removed += _dm_remove_stale(names->name, uuid_prefix);
+	} while (next);
+
+	if (removed)
+		dm_task_update_nodes();
+out:
+	dm_task_destroy(dmt);
+}
+
 #define UUID_LEN 37 /* 36 + \0, libuuid ... */
 /*
  * UUID has format: CRYPT-<devicetype>-[<uuid>-]<device name>
  * CRYPT-PLAIN-name
  * CRYPT-LUKS1-00000000000000000000000000000000-name
- * CRYPT-TEMP-name
+ * CRYPT-TEMP-[<pid namespace inode>-]name
  */
 static void dm_prepare_uuid(const char *name, const char *type, const char *uuid, char *buf, size_t buflen)
 {
@@ -399,7 +676,8 @@ static void dm_prepare_uuid(const char *name, const char *type, const char *uuid
 				*ptr = uuid[i];
 				ptr++;
 			}
-	}
+	} else if (type && !strcmp(type, "TEMP") && _dm_pid_ns())
+		snprintf(uuid2, sizeof(uuid2), "%llu", _dm_pid_ns());
 
 	i = snprintf(buf, buflen, DM_UUID_PREFIX "%s%s%s%s%s",
 		type ?: "", type ? "-" : "",
@@ -426,6 +704,14 @@ int dm_create_device(const char *name,
 	uint32_t cookie = 0;
 	uint16_t udev_flags = 0;
 
+	/* Kernel check is postponed from dm_init() to the first table load */
+	if (!_dm_check_versions()) {
+		log_err(_context, _("Cannot initialize device-mapper. Is dm_mod kernel module loaded?\n"));
+		return -ENOSYS;
+	}
+
+	crypt_probe2(dm__create, name, type);
+
 	params = get_params(dmd);
 	if (!params)
 		goto out_no_removal;
@@ -500,7 +786,7 @@ out:
 		if (get_error())
 			error = strdup(get_error());
 
-		dm_remove_device(name, 0, 0);
+		dm_remove_device(NULL, name, 0, 0);
 
 		if (error) {
 			set_error(error);
@@ -517,17 +803,119 @@ out_no_removal:
 	if (dmt)
 		dm_task_destroy(dmt);
 
+	dm_task_update_nodes();
+	crypt_probe2(dm__create__done, name, r);
+	return r;
+}
+
+/*
+ * Reload device with multi-segment table (online reencryption) and resume it.
+ * Segments are mapped one after another from sector 0.
+ */
+int dm_reload_segments(const char *name,
+		       struct crypt_dm_segment *segs,
+		       int count,
+		       uint32_t flags)
+{
+	struct dm_task *dmt = NULL;
+	struct crypt_dm_active_device dmd = { .flags = flags };
+	char *params = NULL;
+	uint64_t start = 0;
+	uint32_t cookie = 0;
+	int i, r = -EINVAL;
+
+	if (!_dm_check_versions()) {
+		log_err(_context, _("Cannot initialize device-mapper. Is dm_mod kernel module loaded?\n"));
+		return -ENOSYS;
+	}
+
+	if (!(dmt = dm_task_create(DM_DEVICE_RELOAD)))
+		goto out;
+
+	if (!dm_task_set_name(dmt, name))
+		goto out;
+
+	if ((dm_flags() & DM_SECURE_SUPPORTED) && !dm_task_secure_data(dmt))
+		goto out;
+	if ((flags & CRYPT_ACTIVATE_READONLY) && !dm_task_set_ro(dmt))
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		if (segs[i].cipher) {
+			dmd.device = segs[i].device;
+			dmd.cipher = segs[i].cipher;
+			dmd.vk = segs[i].vk;
+			dmd.offset = segs[i].offset;
+			dmd.iv_offset = segs[i].iv_offset;
+			params = get_params(&dmd);
+		} else
+			params = get_linear_params(segs[i].device, segs[i].offset);
+		if (!params)
+			goto out;
+
+		log_dbg("Segment %d: %s, start %" PRIu64 ", size %" PRIu64 ".", i,
+			segs[i].cipher ?: DM_LINEAR_TARGET, start, segs[i].size);
+
+		if (!dm_task_add_target(dmt, start, segs[i].size, segs[i].cipher ?
+					DM_CRYPT_TARGET : DM_LINEAR_TARGET, params))
+			goto out;
+
+		start += segs[i].size;
+		crypt_safe_free(params);
+		params = NULL;
+	}
+
+	if (!dm_task_run(dmt))
+		goto out;
+
+	/* Resume swaps the new table in */
+	dm_task_destroy(dmt);
+	if (!(dmt = dm_task_create(DM_DEVICE_RESUME)))
+		goto out;
+	if (!dm_task_set_name(dmt, name))
+		goto out;
+	if (_dm_use_udev() && !_dm_task_set_cookie(dmt, &cookie, 0))
+		goto out;
+	if (!dm_task_run(dmt))
+		goto out;
+
+	r = 0;
+out:
+	if (cookie && _dm_use_udev())
+		(void)_dm_udev_wait(cookie);
+
+	crypt_safe_free(params);
+	if (dmt)
+		dm_task_destroy(dmt);
+
 	dm_task_update_nodes();
 	return r;
 }
 
+int dm_suspend_device(const char *name)
+{
+	if (!_dm_simple(DM_DEVICE_SUSPEND, name, 0))
+		return -EINVAL;
+
+	return 0;
+}
+
+int dm_resume_device(const char *name)
+{
+	if (!_dm_simple(DM_DEVICE_RESUME, name, 1))
+		return -EINVAL;
+
+	return 0;
+}
+
 static int dm_status_dmi(const char *name, struct dm_info *dmi)
 {
 	struct dm_task *dmt;
 	uint64_t start, length;
 	char *target_type, *params;
+	const char *uuid;
 	void *next = NULL;
-	int r = -EINVAL;
+	int crypt = 0, r = -EINVAL;
 
 	if (!(dmt = dm_task_create(DM_DEVICE_STATUS)))
 		goto out;
@@ -546,12 +934,21 @@ static int dm_status_dmi(const char *name, struct dm_info *dmi)
 		goto out;
 	}
 
-	next = dm_get_next_target(dmt, next, &start, &length,
-	                          &target_type, &params);
-	if (!target_type || strcmp(target_type, DM_CRYPT_TARGET) != 0 ||
-	    start != 0 || next)
-		r = -EINVAL;
-	else
+	/* Reencrypted device can have more crypt and linear segments */
+	do {
+		next = dm_get_next_target(dmt, next, &start, &length,
+					  &target_type, &params);
+		if (!target_type)
+			goto out;
+		if (!strcmp(target_type, DM_CRYPT_TARGET))
+			crypt = 1;
+		else if (strcmp(target_type, DM_LINEAR_TARGET))
+			goto out;
+	} while (next);
+
+	/* Only linear segments are cryptsetup device if it owns UUID */
+	uuid = dm_task_get_uuid(dmt);
+	if (crypt || (uuid && !strncmp(uuid, DM_UUID_PREFIX, DM_UUID_PREFIX_LEN)))
 		r = 0;
 out:
 	if (dmt)
@@ -589,12 +986,13 @@ int dm_query_device(const char *name, uint32_t get_flags,
 {
 	struct dm_task *dmt;
 	struct dm_info dmi;
-	uint64_t start, length, val64;
-	char *target_type, *params, *rcipher, *key_, *rdevice, *endp, buffer[3], *arg;
+	uint64_t start, length, size = 0, val64;
+	char *target_type, *params, *crypt_params = NULL, *rcipher, *key_,
+	     *rdevice, *endp, buffer[3], *arg;
 	const char *tmp_uuid;
 	void *next = NULL;
 	unsigned int i;
-	int r = -EINVAL;
+	int segments = 0, r = -EINVAL;
 
 	memset(dmd, 0, sizeof(*dmd));
 
@@ -619,13 +1017,36 @@ int dm_query_device(const char *name, uint32_t get_flags,
 
 	tmp_uuid = dm_task_get_uuid(dmt);
 
-	next = dm_get_next_target(dmt, next, &start, &length,
-	                          &target_type, &params);
-	if (!target_type || strcmp(target_type, DM_CRYPT_TARGET) != 0 ||
-	    start != 0 || next)
+	/*
+	 * During online reencryption table contains more segments,
+	 * parameters are taken from the first crypt segment.
+	 */
+	do {
+		next = dm_get_next_target(dmt, next, &start, &length,
+					  &target_type, &params);
+		if (!target_type || (!size && start != 0))
+			goto out;
+		if (!strcmp(target_type, DM_CRYPT_TARGET)) {
+			if (!crypt_params)
+				crypt_params = params;
+		} else if (strcmp(target_type, DM_LINEAR_TARGET))
+			goto out;
+		size += length;
+		segments++;
+	} while (next);
+
+	if (!crypt_params)
 		goto out;
 
-	dmd->size = length;
+	/* Parameters do not describe the whole reencrypted device */
+	if (segments > 1 && !(get_flags & DM_ACTIVE_SEGMENTS)) {
+		log_dbg("Device %s has %d segments.", name, segments);
+		r = -EBUSY;
+		goto out;
+	}
+
+	params = crypt_params;
+	dmd->size = size;
 
 	rcipher = strsep(&params, " ");
 	/* cipher */
@@ -729,6 +1150,143 @@ out:
 	return r;
 }
 
+/*
+ * Fill list entry from one table query, without the device path lookup
+ * done in dm_query_device(). Returns -ENOENT for foreign devices.
+ */
+static int _dm_list_entry(const char *name, struct crypt_active_entry *e)
+{
+	struct dm_task *dmt;
+	struct dm_info dmi;
+	uint64_t start, length;
+	char *target_type, *params, *crypt_params = NULL, *p;
+	const char *uuid;
+	unsigned int major, minor;
+	void *next = NULL;
+	int r = -ENOENT;
+
+	memset(e, 0, sizeof(*e));
+
+	if (!(dmt = dm_task_create(DM_DEVICE_TABLE)))
+		return -EINVAL;
+	if ((dm_flags() & DM_SECURE_SUPPORTED) && !dm_task_secure_data(dmt))
+		goto out;
+	if (!dm_task_set_name(dmt, name) || !dm_task_run(dmt) ||
+	    !dm_task_get_info(dmt, &dmi) || !dmi.exists)
+		goto out;
+
+	uuid = dm_task_get_uuid(dmt);
+	if (!uuid || strncmp(uuid, DM_UUID_PREFIX, DM_UUID_PREFIX_LEN))
+		goto out;
+	uuid += DM_UUID_PREFIX_LEN;
+
+	r = -ENOMEM;
+	if (!(e->name = strdup(name)) || !(e->uuid = strdup(uuid)))
+		goto out;
+	r = 0;
+
+	/* Type is the first UUID part, e.g. CRYPT-LUKS1-<uuid>-<name> */
+	strncpy(e->type, uuid, sizeof(e->type) - 1);
+	if ((p = strchr(e->type, '-')))
+		*p = '\0';
+
+	if (dmi.read_only)
+		e->flags |= CRYPT_ACTIVATE_READONLY;
+
+	/* Size of all segments, the rest from the first crypt segment */
+	do {
+		next = dm_get_next_target(dmt, next, &start, &length,
+					  &target_type, &params);
+		if (!target_type)
+			break;
+		if (!crypt_params && !strcmp(target_type, DM_CRYPT_TARGET))
+			crypt_params = params;
+		e->size += length;
+	} while (next);
+
+	/* <cipher> <key> <iv_offset> <major:minor> <offset> [<#opt> <opt>...] */
+	if (crypt_params && sscanf(crypt_params, "%*s %*s %" SCNu64 " %u:%u %" SCNu64,
+				   &e->iv_offset, &major, &minor, &e->offset) == 4) {
+		e->device_major = major;
+		e->device_minor = minor;
+		if (strstr(crypt_params, " allow_discards"))
+			e->flags |= CRYPT_ACTIVATE_ALLOW_DISCARDS;
+	}
+
+	/* Key is part of table parameters */
+	if (crypt_params)
+		memset(crypt_params, 0, strlen(crypt_params));
+out:
+	dm_task_destroy(dmt);
+	if (r == -ENOMEM) {
+		free(e->name);
+		free(e->uuid);
+	}
+	return r;
+}
+
+/*
+ * All devices with CRYPT- UUID, names come from one DM_DEVICE_LIST call
+ * followed by one table query per device.
+ */
+int dm_list_devices(struct crypt_active_entry **list)
+{
+	struct crypt_active_entry *l = NULL, *tmp, e;
+	struct dm_task *dmt;
+	struct dm_names *names;
+	unsigned int next = 0;
+	int count = 0, r = -EINVAL;
+
+	*list = NULL;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_LIST)))
+		return -EINVAL;
+
+	if (!dm_task_run(dmt) || !(names = dm_task_get_names(dmt)))
+		goto out;
+
+	r = 0;
+	if (!names->dev)
+		goto out;
+
+	do {
+		names = (struct dm_names *)((char *)names + next);
+		next = names->next;
+
+		/* Device can be removed in the meantime */
+		r = _dm_list_entry(names->name, &e);
+		if (r == -ENOENT || r == -EINVAL)
+			continue;
+		if (r < 0)
+			goto out;
+
+		tmp = realloc(l, (count + 1) * sizeof(*l));
+		if (!tmp) {
+			free(e.name);
+			free(e.uuid);
+			r = -ENOMEM;
+			goto out;
+		}
+		l = tmp;
+		l[count++] = e;
+	} while (next);
+	r = 0;
+out:
+	dm_task_destroy(dmt);
+
+	if (r < 0) {
+		while (count--) {
+			free(l[count].name);
+			free(l[count].uuid);
+		}
+		free(l);
+		return r;
+	}
+
+	*list = l;
+	return count;
+}
+
 static int _dm_message(const char *name, const char *msg)
 {
 	int r = 0;
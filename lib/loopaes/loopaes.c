@@ -49,24 +49,6 @@ static unsigned char get_tweak(unsigned int keys_count)
 	return 0x00;
 }
 
-static int hash_key(const char *src, size_t src_len,
-		    char *dst, size_t dst_len,
-		    const char *hash_name)
-{
-	struct crypt_hash *hd = NULL;
-	int r;
-
-	if (crypt_hash_init(&hd, hash_name))
-		return -EINVAL;
-
-	r = crypt_hash_write(hd, src, src_len);
-	if (!r)
-		r = crypt_hash_final(hd, dst, dst_len);
-
-	crypt_hash_destroy(hd);
-	return r;
-}
-
 static int hash_keys(struct crypt_device *cd,
 		     struct volume_key **vk,
 		     const char *hash_override,
@@ -74,6 +56,7 @@ static int hash_keys(struct crypt_device *cd,
 		     unsigned int keys_count,
 		     unsigned int key_len_output)
 {
+	struct crypt_hash *hd = NULL;
 	const char *hash_name;
 	char tweak, *key_ptr;
 	unsigned i, key_len_input;
@@ -93,16 +76,26 @@ static int hash_keys(struct crypt_device *cd,
 	if (!*vk)
 		return -ENOMEM;
 
-	for (i = 0; i < keys_count; i++) {
+	/*
+	 * One hash context for all keys, hash final restarts it
+	 * (for kernel backend it saves socket setup for every key).
+	 */
+	r = crypt_hash_init(&hd, hash_name) ? -EINVAL : 0;
+
+	for (i = 0; !r && i < keys_count; i++) {
 		key_ptr = &(*vk)->key[i * key_len_output];
-		r = hash_key(input_keys[i], key_len_input, key_ptr,
-			     key_len_output, hash_name);
+		r = crypt_hash_write(hd, input_keys[i], key_len_input);
+		if (!r)
+			r = crypt_hash_final(hd, key_ptr, key_len_output);
 		if (r < 0)
 			break;
 
 		key_ptr[0] ^= tweak;
 	}
 
+	if (hd)
+		crypt_hash_destroy(hd);
+
 	if (r < 0 && *vk) {
 		crypt_free_volume_key(*vk);
 		*vk = NULL;
@@ -110,19 +103,6 @@ static int hash_keys(struct crypt_device *cd,
 	return r;
 }
 
-static int keyfile_is_gpg(char *buffer, size_t buffer_len)
-{
-	int r = 0;
-	int index = buffer_len < 100 ? buffer_len - 1 : 100;
-	char eos = buffer[index];
-
-	buffer[index] = '\0';
-	if (strstr(buffer, "BEGIN PGP MESSAGE"))
-		r = 1;
-	buffer[index] = eos;
-	return r;
-}
-
 int LOOPAES_parse_keyfile(struct crypt_device *cd,
 			  struct volume_key **vk,
 			  const char *hash,
@@ -138,7 +118,8 @@ int LOOPAES_parse_keyfile(struct crypt_device *cd,
 	if (!buffer_len)
 		return -EINVAL;
 
-	if (keyfile_is_gpg(buffer, buffer_len)) {
+	/* Already decrypted keyfile cannot be GPG encrypted again */
+	if (LOOPAES_keyfile_is_gpg(buffer, buffer_len)) {
 		log_err(cd, _("Detected not yet supported GPG encrypted keyfile.\n"));
 		log_std(cd, _("Please use gpg --decrypt <KEYFILE> | cryptsetup --keyfile=- ...\n"));
 		return -EINVAL;
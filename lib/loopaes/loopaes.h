@@ -16,6 +16,12 @@ int LOOPAES_parse_keyfile(struct crypt_device *cd,
 			  char *buffer,
 			  size_t buffer_len);
 
+int LOOPAES_keyfile_is_gpg(const char *buffer, size_t buffer_len);
+int LOOPAES_gpg_decrypt(struct crypt_device *cd,
+			const char *passphrase, size_t passphrase_len,
+			const char *buffer, size_t buffer_len,
+			char **keys, size_t *keys_len);
+
 int LOOPAES_activate(struct crypt_device *cd,
 		     const char *name,
 		     const char *base_cipher,
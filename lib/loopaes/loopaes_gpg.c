@@ -0,0 +1,722 @@
+/*
+ * loop-AES compatible volume handling, GPG encrypted keyfile
+ *
+ * Copyright (C) 2012, Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Minimal OpenPGP (RFC 4880) reader for symmetrically encrypted keyfiles,
+ * as created by "gpg --symmetric -a": ASCII armor, passphrase S2K,
+ * encrypted data packet (with or without MDC), compressed packet
+ * (with zlib only) and literal data packet.
+ *
+ * Cipher is used through kernel userspace crypto API (ECB mode, CFB is
+ * done here). Everything decrypted is kept in locked (safe) memory.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto_backend.h"
+#include "loopaes.h"
+
+/* HAVE_ZLIB comes from config.h included above */
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define PGP_ARMOR_BEGIN		"-----BEGIN PGP MESSAGE-----"
+
+#define PGP_TAG_SKESK		3
+#define PGP_TAG_COMPRESSED	8
+#define PGP_TAG_SED		9
+#define PGP_TAG_MARKER		10
+#define PGP_TAG_LITERAL		11
+#define PGP_TAG_SEIPD		18
+
+#define PGP_MDC_LEN		22	/* 0xd3 0x14 SHA1 */
+#define PGP_KEY_MAX		32
+#define PGP_BLOCK_MAX		16
+#define PGP_NESTING_MAX		4
+#define PGP_PLAINTEXT_MAX	(1024 * 1024)
+
+/* Repeated salt and passphrase are hashed in chunks of this size */
+#define PGP_S2K_CHUNK		8192
+
+struct pgp_cipher {
+	int id;
+	const char *name;
+	size_t key_size;
+};
+
+static const struct pgp_cipher pgp_ciphers[] = {
+	{  2, "des3_ede", 24 },
+	{  3, "cast5",    16 },
+	{  4, "blowfish", 16 },
+	{  7, "aes",      16 },
+	{  8, "aes",      24 },
+	{  9, "aes",      32 },
+	{ 10, "twofish",  32 },
+	{ 11, "camellia", 16 },
+	{ 12, "camellia", 24 },
+	{ 13, "camellia", 32 },
+	{  0, NULL,        0 }
+};
+
+struct pgp_hash {
+	int id;
+	const char *name;
+};
+
+static const struct pgp_hash pgp_hashes[] = {
+	{  1, "md5" },
+	{  2, "sha1" },
+	{  3, "ripemd160" },
+	{  8, "sha256" },
+	{  9, "sha384" },
+	{ 10, "sha512" },
+	{ 11, "sha224" },
+	{  0, NULL }
+};
+
+struct pgp_packet {
+	int tag;
+	unsigned char *body;	/* safe memory */
+	size_t len;
+};
+
+static const struct pgp_cipher *pgp_get_cipher(int id)
+{
+	int i;
+
+	for (i = 0; pgp_ciphers[i].name; i++)
+		if (pgp_ciphers[i].id == id)
+			return &pgp_ciphers[i];
+	return NULL;
+}
+
+static const char *pgp_get_hash(int id)
+{
+	int i;
+
+	for (i = 0; pgp_hashes[i].name; i++)
+		if (pgp_hashes[i].id == id)
+			return pgp_hashes[i].name;
+	return NULL;
+}
+
+int LOOPAES_keyfile_is_gpg(const char *buffer, size_t buffer_len)
+{
+	size_t len = buffer_len < 100 ? buffer_len : 100;
+
+	return memmem(buffer, len, PGP_ARMOR_BEGIN, strlen(PGP_ARMOR_BEGIN)) != NULL;
+}
+
+/* ASCII armor to binary, armor checksum is not checked (MDC is) */
+static int pgp_dearmor(const char *buffer, size_t buffer_len,
+		       unsigned char **out, size_t *out_len)
+{
+	static const char b64[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const char *p, *end = buffer + buffer_len, *c;
+	unsigned int acc = 0, bits = 0;
+	int headers = 1;
+	size_t len = 0;
+
+	p = memmem(buffer, buffer_len, PGP_ARMOR_BEGIN, strlen(PGP_ARMOR_BEGIN));
+	if (!p)
+		return -EINVAL;
+
+	*out = malloc(buffer_len / 4 * 3 + 3);
+	if (!*out)
+		return -ENOMEM;
+
+	/* Skip armor line and headers up to the empty line */
+	while (p < end && headers) {
+		c = memchr(p, '\n', end - p);
+		if (!c)
+			break;
+		p = c + 1;
+		if (p < end && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'))) {
+			p += (*p == '\r') ? 2 : 1;
+			headers = 0;
+		}
+	}
+
+	for (; !headers && p < end; p++) {
+		/* Checksum or armor tail line ends data */
+		if ((p == buffer || p[-1] == '\n') && (*p == '=' || *p == '-'))
+			break;
+		if (*p == '=') {
+			while (p < end && *p != '\n')
+				p++;
+			continue;
+		}
+		if (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')
+			continue;
+		if (!*p || !(c = strchr(b64, *p)))
+			goto err;
+
+		acc = (acc << 6) | (unsigned int)(c - b64);
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			(*out)[len++] = (acc >> bits) & 0xff;
+		}
+	}
+
+	if (headers || !len)
+		goto err;
+
+	*out_len = len;
+	return 0;
+err:
+	free(*out);
+	*out = NULL;
+	return -EINVAL;
+}
+
+static int pgp_new_length(const unsigned char *buf, size_t buf_len, size_t *pos,
+			  size_t *len, int *partial)
+{
+	size_t i = *pos;
+	unsigned char c;
+
+	if (i >= buf_len)
+		return -EINVAL;
+
+	c = buf[i++];
+	*partial = 0;
+	if (c < 192)
+		*len = c;
+	else if (c < 224) {
+		if (i >= buf_len)
+			return -EINVAL;
+		*len = ((size_t)(c - 192) << 8) + buf[i++] + 192;
+	} else if (c == 255) {
+		if (i + 4 > buf_len)
+			return -EINVAL;
+		*len = ((size_t)buf[i] << 24) | ((size_t)buf[i + 1] << 16) |
+		       ((size_t)buf[i + 2] << 8) | buf[i + 3];
+		i += 4;
+	} else {
+		*len = (size_t)1 << (c & 0x1f);
+		*partial = 1;
+	}
+
+	*pos = i;
+	return 0;
+}
+
+/* Read packet at *pos, partial body chunks are joined */
+static int pgp_read_packet(const unsigned char *buf, size_t buf_len,
+			   size_t *pos, struct pgp_packet *pkt)
+{
+	size_t i = *pos, len, n;
+	unsigned char ctb;
+	int partial;
+
+	memset(pkt, 0, sizeof(*pkt));
+	if (i >= buf_len || !((ctb = buf[i++]) & 0x80))
+		return -EINVAL;
+
+	/* Body is never longer than the rest of buffer */
+	pkt->body = crypt_safe_alloc(buf_len - i + 1);
+	if (!pkt->body)
+		return -ENOMEM;
+
+	if (!(ctb & 0x40)) {
+		/* Old format, length type 3 is the rest of buffer */
+		pkt->tag = (ctb >> 2) & 0x0f;
+		if ((ctb & 0x03) == 3)
+			len = buf_len - i;
+		else {
+			n = (size_t)1 << (ctb & 0x03);
+			if (i + n > buf_len)
+				goto err;
+			for (len = 0; n; n--)
+				len = (len << 8) | buf[i++];
+		}
+		if (len > buf_len - i)
+			goto err;
+		memcpy(pkt->body, &buf[i], len);
+		pkt->len = len;
+		i += len;
+	} else {
+		pkt->tag = ctb & 0x3f;
+		do {
+			if (pgp_new_length(buf, buf_len, &i, &len, &partial) ||
+			    len > buf_len - i)
+				goto err;
+			memcpy(pkt->body + pkt->len, &buf[i], len);
+			pkt->len += len;
+			i += len;
+		} while (partial);
+	}
+
+	*pos = i;
+	return 0;
+err:
+	crypt_safe_free(pkt->body);
+	pkt->body = NULL;
+	return -EINVAL;
+}
+
+/*
+ * String-to-key specifier, returns its length or negative errno.
+ * Hash context i is preloaded with i zero bytes if key is longer than hash.
+ */
+static int pgp_s2k(const unsigned char *s2k, size_t s2k_len,
+		   const char *passphrase, size_t passphrase_len,
+		   char *key, size_t key_len)
+{
+	struct crypt_hash *hd = NULL;
+	const char *hash_name;
+	char *data = NULL, digest[64];
+	size_t salt_len, data_len, chunk, count, left, done, n;
+	int i, pass, used, r = -EINVAL;
+
+	if (s2k_len < 2)
+		return -EINVAL;
+
+	switch (s2k[0]) {
+	case 0: salt_len = 0; used = 2; break;
+	case 1: salt_len = 8; used = 10; break;
+	case 3: salt_len = 8; used = 11; break;
+	default: return -ENOTSUP;
+	}
+	if (s2k_len < (size_t)used)
+		return -EINVAL;
+
+	hash_name = pgp_get_hash(s2k[1]);
+	if (!hash_name || crypt_hash_size(hash_name) <= 0 ||
+	    crypt_hash_size(hash_name) > (int)sizeof(digest))
+		return -ENOTSUP;
+
+	data_len = salt_len + passphrase_len;
+	if (s2k[0] == 3)
+		count = (size_t)(16 + (s2k[10] & 15)) << ((s2k[10] >> 4) + 6);
+	else
+		count = data_len;
+	if (count < data_len)
+		count = data_len;
+
+	/* Salt and passphrase repeated, the hashed stream is periodic */
+	chunk = data_len ? (PGP_S2K_CHUNK / data_len + 1) * data_len : 1;
+	data = crypt_safe_alloc(chunk);
+	if (!data)
+		return -ENOMEM;
+	for (n = 0; data_len && n < chunk; n += data_len) {
+		memcpy(&data[n], &s2k[2], salt_len);
+		memcpy(&data[n + salt_len], passphrase, passphrase_len);
+	}
+
+	for (pass = 0, done = 0; done < key_len; pass++) {
+		if (crypt_hash_init(&hd, hash_name)) {
+			r = -EINVAL;
+			goto out;
+		}
+
+		for (i = 0, r = 0; i < pass && !r; i++)
+			r = crypt_hash_write(hd, "", 1);
+
+		for (left = count; left && !r; left -= n) {
+			n = left > chunk ? chunk : left;
+			r = crypt_hash_write(hd, data, n);
+		}
+
+		n = crypt_hash_size(hash_name);
+		if (!r)
+			r = crypt_hash_final(hd, digest, n);
+		crypt_hash_destroy(hd);
+		if (r)
+			goto out;
+
+		if (n > key_len - done)
+			n = key_len - done;
+		memcpy(&key[done], digest, n);
+		done += n;
+	}
+	r = used;
+out:
+	memset(digest, 0, sizeof(digest));
+	crypt_safe_free(data);
+	return r;
+}
+
+/*
+ * CFB decryption, keystream blocks are encryption of IV and previous
+ * ciphertext blocks, so all of them are computed by one ECB call.
+ */
+static int pgp_cfb_decrypt(struct crypt_cipher *cipher, size_t bs,
+			   const unsigned char *iv,
+			   const unsigned char *in, unsigned char *out, size_t len)
+{
+	unsigned char *ks;
+	size_t ks_len, i;
+	int r;
+
+	if (!len)
+		return 0;
+
+	ks_len = (len + bs - 1) / bs * bs;
+	ks = crypt_safe_alloc(ks_len);
+	if (!ks)
+		return -ENOMEM;
+
+	memcpy(ks, iv, bs);
+	memcpy(&ks[bs], in, ks_len - bs);
+
+	r = crypt_cipher_encrypt(cipher, (char *)ks, (char *)ks, ks_len, NULL, 0);
+	if (!r)
+		for (i = 0; i < len; i++)
+			out[i] = in[i] ^ ks[i];
+
+	crypt_safe_free(ks);
+	return r;
+}
+
+/* Verify MDC packet appended to SEIPD plaintext */
+static int pgp_check_mdc(const unsigned char *data, size_t len)
+{
+	struct crypt_hash *hd = NULL;
+	char digest[20];
+	int r;
+
+	if (len < PGP_MDC_LEN || data[len - PGP_MDC_LEN] != 0xd3 ||
+	    data[len - PGP_MDC_LEN + 1] != 0x14)
+		return -EINVAL;
+
+	if (crypt_hash_init(&hd, "sha1"))
+		return -ENOTSUP;
+
+	r = crypt_hash_write(hd, (const char *)data, len - sizeof(digest));
+	if (!r)
+		r = crypt_hash_final(hd, digest, sizeof(digest));
+	crypt_hash_destroy(hd);
+
+	if (!r && memcmp(digest, &data[len - sizeof(digest)], sizeof(digest)))
+		r = -EPERM;
+
+	memset(digest, 0, sizeof(digest));
+	return r;
+}
+
+/* Decrypt SED or SEIPD packet body, returns plaintext packets */
+static int pgp_decrypt_data(const struct pgp_cipher *pc, const char *key,
+			    const struct pgp_packet *pkt,
+			    unsigned char **out, size_t *out_len)
+{
+	struct crypt_cipher *cipher = NULL;
+	unsigned char zero_iv[PGP_BLOCK_MAX] = { 0 }, *data, *plain;
+	size_t bs, len, prefix;
+	int r, bsr;
+
+	bsr = crypt_cipher_blocksize(pc->name);
+	if (bsr <= 0 || bsr > PGP_BLOCK_MAX)
+		return -ENOTSUP;
+	bs = bsr;
+	prefix = bs + 2;
+
+	data = pkt->body;
+	len = pkt->len;
+	if (pkt->tag == PGP_TAG_SEIPD) {
+		if (!len || data[0] != 1)
+			return -ENOTSUP;
+		data++;
+		len--;
+	}
+	if (len < prefix + (pkt->tag == PGP_TAG_SEIPD ? PGP_MDC_LEN : 0))
+		return -EINVAL;
+
+	plain = crypt_safe_alloc(len);
+	if (!plain)
+		return -ENOMEM;
+
+	r = crypt_cipher_init(&cipher, pc->name, "ecb", key, pc->key_size);
+	if (r < 0)
+		goto out;
+
+	if (pkt->tag == PGP_TAG_SEIPD)
+		r = pgp_cfb_decrypt(cipher, bs, zero_iv, data, plain, len);
+	else {
+		/* Old packet, CFB is resynchronized after random prefix */
+		r = pgp_cfb_decrypt(cipher, bs, zero_iv, data, plain, prefix);
+		if (!r)
+			r = pgp_cfb_decrypt(cipher, bs, &data[2], &data[prefix],
+					    &plain[prefix], len - prefix);
+	}
+	if (r < 0)
+		goto out;
+
+	/* Quick check of random prefix, wrong passphrase usually */
+	if (plain[bs - 2] != plain[bs] || plain[bs - 1] != plain[bs + 1]) {
+		r = -EPERM;
+		goto out;
+	}
+
+	if (pkt->tag == PGP_TAG_SEIPD) {
+		r = pgp_check_mdc(plain, len);
+		if (r < 0)
+			goto out;
+		len -= PGP_MDC_LEN;
+	}
+
+	*out_len = len - prefix;
+	*out = crypt_safe_alloc(*out_len + 1);
+	if (!*out) {
+		r = -ENOMEM;
+		goto out;
+	}
+	memcpy(*out, &plain[prefix], *out_len);
+	r = 0;
+out:
+	if (cipher)
+		crypt_cipher_destroy(cipher);
+	crypt_safe_free(plain);
+	return r;
+}
+
+#ifdef HAVE_ZLIB
+static voidpf pgp_zalloc(voidpf opaque __attribute__((unused)), uInt items, uInt size)
+{
+	return crypt_safe_alloc((size_t)items * size);
+}
+
+static void pgp_zfree(voidpf opaque __attribute__((unused)), voidpf address)
+{
+	crypt_safe_free(address);
+}
+
+/* ZIP is raw deflate, ZLIB has zlib header */
+static int pgp_inflate(int algo, const unsigned char *in, size_t in_len,
+		       unsigned char **out, size_t *out_len)
+{
+	z_stream zs;
+	size_t size = 4096;
+	int r;
+
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = pgp_zalloc;
+	zs.zfree = pgp_zfree;
+	if (inflateInit2(&zs, algo == 1 ? -MAX_WBITS : MAX_WBITS) != Z_OK)
+		return -ENOMEM;
+
+	*out = crypt_safe_alloc(size);
+	if (!*out) {
+		inflateEnd(&zs);
+		return -ENOMEM;
+	}
+
+	zs.next_in = (Bytef *)in;
+	zs.avail_in = in_len;
+	do {
+		if (zs.total_out == size) {
+			size *= 2;
+			if (size > PGP_PLAINTEXT_MAX ||
+			    !(*out = crypt_safe_realloc(*out, size))) {
+				r = Z_MEM_ERROR;
+				break;
+			}
+		}
+		zs.next_out = *out + zs.total_out;
+		zs.avail_out = size - zs.total_out;
+		r = inflate(&zs, Z_NO_FLUSH);
+	} while (r == Z_OK);
+
+	*out_len = zs.total_out;
+	inflateEnd(&zs);
+
+	if (r != Z_STREAM_END) {
+		crypt_safe_free(*out);
+		*out = NULL;
+		return -EINVAL;
+	}
+	return 0;
+}
+#else
+static int pgp_inflate(int algo __attribute__((unused)),
+		       const unsigned char *in __attribute__((unused)),
+		       size_t in_len __attribute__((unused)),
+		       unsigned char **out __attribute__((unused)),
+		       size_t *out_len __attribute__((unused)))
+{
+	return -ENOTSUP;
+}
+#endif
+
+/* Find literal data in decrypted packets, possibly compressed */
+static int pgp_literal(const unsigned char *buf, size_t buf_len, int depth,
+		       char **keys, size_t *keys_len)
+{
+	struct pgp_packet pkt;
+	unsigned char *data = NULL;
+	size_t pos = 0, len, skip;
+	int r;
+
+	if (depth > PGP_NESTING_MAX)
+		return -EINVAL;
+
+	r = pgp_read_packet(buf, buf_len, &pos, &pkt);
+	if (r < 0)
+		return r;
+
+	if (pkt.tag == PGP_TAG_COMPRESSED && pkt.len) {
+		if (!pkt.body[0])
+			r = pgp_literal(&pkt.body[1], pkt.len - 1, depth + 1,
+					keys, keys_len);
+		else if (pkt.body[0] == 1 || pkt.body[0] == 2) {
+			r = pgp_inflate(pkt.body[0], &pkt.body[1], pkt.len - 1,
+					&data, &len);
+			if (!r)
+				r = pgp_literal(data, len, depth + 1, keys, keys_len);
+			crypt_safe_free(data);
+		} else
+			r = -ENOTSUP;
+	} else if (pkt.tag == PGP_TAG_LITERAL && pkt.len >= 2) {
+		/* format, file name length, file name, 4 bytes date */
+		skip = 2 + pkt.body[1] + 4;
+		if (skip > pkt.len || pkt.len - skip > PGP_PLAINTEXT_MAX)
+			r = -EINVAL;
+		else {
+			*keys_len = pkt.len - skip;
+			*keys = crypt_safe_alloc(*keys_len + 1);
+			if (*keys)
+				memcpy(*keys, &pkt.body[skip], *keys_len);
+			else
+				r = -ENOMEM;
+		}
+	} else
+		r = -ENOTSUP;
+
+	crypt_safe_free(pkt.body);
+	return r;
+}
+
+int LOOPAES_gpg_decrypt(struct crypt_device *cd,
+			const char *passphrase, size_t passphrase_len,
+			const char *buffer, size_t buffer_len,
+			char **keys, size_t *keys_len)
+{
+	const struct pgp_cipher *pc = NULL;
+	struct pgp_packet skesk = { 0 }, pkt = { 0 };
+	unsigned char *bin = NULL, *plain = NULL;
+	unsigned char zero_iv[PGP_BLOCK_MAX] = { 0 };
+	struct crypt_cipher *cipher = NULL;
+	char *key = NULL, *session = NULL;
+	size_t bin_len, pos = 0, plain_len = 0;
+	int r, s2k_len, bs;
+
+	*keys = NULL;
+	*keys_len = 0;
+
+	r = pgp_dearmor(buffer, buffer_len, &bin, &bin_len);
+	if (r < 0)
+		goto out;
+
+	/* Symmetric key packet must precede encrypted data */
+	while (!r && pos < bin_len) {
+		crypt_safe_free(pkt.body);
+		r = pgp_read_packet(bin, bin_len, &pos, &pkt);
+		if (r < 0)
+			break;
+
+		if (pkt.tag == PGP_TAG_SKESK && !skesk.body) {
+			skesk = pkt;
+			pkt.body = NULL;
+		} else if (pkt.tag == PGP_TAG_SED || pkt.tag == PGP_TAG_SEIPD)
+			break;
+		else if (pkt.tag != PGP_TAG_MARKER)
+			r = -ENOTSUP;
+	}
+	if (!r && (!skesk.body || !pkt.body ||
+	    (pkt.tag != PGP_TAG_SED && pkt.tag != PGP_TAG_SEIPD)))
+		r = -EINVAL;
+	if (!r && (skesk.len < 4 || skesk.body[0] != 4 ||
+	    !(pc = pgp_get_cipher(skesk.body[1]))))
+		r = -ENOTSUP;
+	if (r < 0)
+		goto out;
+
+	log_dbg("GPG keyfile: cipher %s-%zu, S2K type %d, %s packet.",
+		pc->name, pc->key_size * 8, skesk.body[2],
+		pkt.tag == PGP_TAG_SEIPD ? "MDC protected" : "unprotected");
+
+	key = crypt_safe_alloc(PGP_KEY_MAX);
+	session = crypt_safe_alloc(PGP_KEY_MAX + 1 + PGP_BLOCK_MAX);
+	if (!key || !session) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	s2k_len = pgp_s2k(&skesk.body[2], skesk.len - 2, passphrase,
+			  passphrase_len, key, pc->key_size);
+	if (s2k_len < 0) {
+		r = s2k_len;
+		goto out;
+	}
+
+	/* Optional encrypted session key: cipher id and the key */
+	if (skesk.len > (size_t)(2 + s2k_len)) {
+		bs = crypt_cipher_blocksize(pc->name);
+		if (bs <= 0 || skesk.len - 2 - s2k_len > PGP_KEY_MAX + 1) {
+			r = -EINVAL;
+			goto out;
+		}
+		r = crypt_cipher_init(&cipher, pc->name, "ecb", key, pc->key_size);
+		if (!r)
+			r = pgp_cfb_decrypt(cipher, bs, zero_iv,
+					    &skesk.body[2 + s2k_len],
+					    (unsigned char *)session,
+					    skesk.len - 2 - s2k_len);
+		if (r < 0)
+			goto out;
+
+		pc = pgp_get_cipher((unsigned char)session[0]);
+		if (!pc || pc->key_size != skesk.len - 3 - s2k_len) {
+			r = -EPERM;
+			goto out;
+		}
+		memcpy(key, &session[1], pc->key_size);
+	}
+
+	r = pgp_decrypt_data(pc, key, &pkt, &plain, &plain_len);
+	if (r < 0)
+		goto out;
+
+	r = pgp_literal(plain, plain_len, 0, keys, keys_len);
+out:
+	if (r == -EPERM)
+		log_err(cd, _("Wrong passphrase for GPG keyfile.\n"));
+	else if (r == -ENOTSUP || r == -ENOENT)
+		log_err(cd, _("Unsupported GPG keyfile format or cipher.\n"));
+	else if (r < 0)
+		log_err(cd, _("Cannot decrypt GPG keyfile.\n"));
+
+	if (r < 0 && r != -EPERM)
+		log_std(cd, _("Please use gpg --decrypt <KEYFILE> | cryptsetup --keyfile=- ...\n"));
+
+	if (cipher)
+		crypt_cipher_destroy(cipher);
+	crypt_safe_free(session);
+	crypt_safe_free(key);
+	crypt_safe_free(plain);
+	crypt_safe_free(pkt.body);
+	crypt_safe_free(skesk.body);
+	free(bin);
+	return r;
+}
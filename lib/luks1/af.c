@@ -38,27 +38,22 @@ static void XORblock(const char *src1, const char *src2, char *dst, size_t n)
 		dst[j] = src1[j] ^ src2[j];
 }
 
-static int hash_buf(const char *src, char *dst, uint32_t iv,
-		    size_t len, const char *hash_name)
+static int hash_buf(struct crypt_hash *hd, const char *src, char *dst,
+		    uint32_t iv, size_t len)
 {
-	struct crypt_hash *hd = NULL;
 	char *iv_char = (char *)&iv;
 	int r;
 
 	iv = htonl(iv);
-	if (crypt_hash_init(&hd, hash_name))
-		return -EINVAL;
 
 	if ((r = crypt_hash_write(hd, iv_char, sizeof(uint32_t))))
-		goto out;
+		return r;
 
 	if ((r = crypt_hash_write(hd, src, len)))
-		goto out;
+		return r;
 
-	r = crypt_hash_final(hd, dst, len);
-out:
-	crypt_hash_destroy(hd);
-	return r;
+	/* final also resets context for the next block */
+	return crypt_hash_final(hd, dst, len);
 }
 
 /* diffuse: Information spreading over the whole dataset with
@@ -67,25 +62,33 @@ out:
 
 static int diffuse(char *src, char *dst, size_t size, const char *hash_name)
 {
+	struct crypt_hash *hd = NULL;
 	unsigned int digest_size = crypt_hash_size(hash_name);
 	unsigned int i, blocks, padding;
+	int r = 1;
 
 	blocks = size / digest_size;
 	padding = size % digest_size;
 
+	if (crypt_hash_init(&hd, hash_name))
+		return 1;
+
 	for (i = 0; i < blocks; i++)
-		if(hash_buf(src + digest_size * i,
+		if(hash_buf(hd, src + digest_size * i,
 			    dst + digest_size * i,
-			    i, (size_t)digest_size, hash_name))
-			return 1;
+			    i, (size_t)digest_size))
+			goto out;
 
 	if(padding)
-		if(hash_buf(src + digest_size * i,
+		if(hash_buf(hd, src + digest_size * i,
 			    dst + digest_size * i,
-			    i, (size_t)padding, hash_name))
-			return 1;
+			    i, (size_t)padding))
+			goto out;
 
-	return 0;
+	r = 0;
+out:
+	crypt_hash_destroy(hd);
+	return r;
 }
 
 /*
@@ -99,46 +102,39 @@ int AF_split(char *src, char *dst, size_t blocksize,
 {
 	unsigned int i;
 	char *bufblock;
-	int r = -EINVAL;
+	int r;
 
-	if((bufblock = calloc(blocksize, 1)) == NULL) return -ENOMEM;
+	/* the last block of dst is used as accumulator */
+	bufblock = dst + blocksize * (blocknumbers - 1);
+	memset(bufblock, 0, blocksize);
 
 	/* process everything except the last block */
 	for(i=0; i<blocknumbers-1; i++) {
 		r = crypt_random_get(NULL, dst+(blocksize*i), blocksize, CRYPT_RND_NORMAL);
-		if(r < 0) goto out;
+		if(r < 0)
+			return r;
 
 		XORblock(dst+(blocksize*i),bufblock,bufblock,blocksize);
 		if(diffuse(bufblock, bufblock, blocksize, hash))
-			goto out;
+			return -EINVAL;
 	}
 	/* the last block is computed */
-	XORblock(src,bufblock,dst+(i*blocksize),blocksize);
-	r = 0;
-out:
-	free(bufblock);
-	return r;
+	XORblock(src,bufblock,bufblock,blocksize);
+	return 0;
 }
 
 int AF_merge(char *src, char *dst, size_t blocksize,
 	     unsigned int blocknumbers, const char *hash)
 {
 	unsigned int i;
-	char *bufblock;
-	int r = -EINVAL;
 
-	if((bufblock = calloc(blocksize, 1)) == NULL)
-		return -ENOMEM;
-
-	memset(bufblock,0,blocksize);
+	/* dst is used as accumulator */
+	memset(dst, 0, blocksize);
 	for(i=0; i<blocknumbers-1; i++) {
-		XORblock(src+(blocksize*i),bufblock,bufblock,blocksize);
-		if(diffuse(bufblock, bufblock, blocksize, hash))
-			goto out;
+		XORblock(src+(blocksize*i),dst,dst,blocksize);
+		if(diffuse(dst, dst, blocksize, hash))
+			return -EINVAL;
 	}
-	XORblock(src + blocksize * i, bufblock, dst, blocksize);
-	r = 0;
-out:
-	free(bufblock);
-	return r;
+	XORblock(src + blocksize * i, dst, dst, blocksize);
+	return 0;
 }
@@ -16,6 +16,9 @@
  * src of the length blocksize*blocknumbers into dst of the length
  * blocksize.
  *
+ * Both functions work in place of the output buffer and do not allocate
+ * memory, src and dst must not overlap.
+ *
  * On error, both functions return -1, 0 otherwise.
  */
 
@@ -45,15 +45,34 @@ static inline int round_up_modulo(int x, int m) {
 	return div_round_up(x, m) * m;
 }
 
-static const char *cleaner_name=NULL;
-static uint64_t cleaner_size = 0;
+#define TEMP_MAPPING_PREFIX "temporary-cryptsetup-"
+
+/*
+ * Temporary keyslot mapping. It is created for the first keyslot access
+ * and only its table is reloaded for following keyslots on the same device,
+ * until LUKS_keyslot_mapping_release() removes it.
+ * Deferred removal keeps the old name in use, so every new mapping
+ * gets the next sequence number.
+ */
+static struct {
+	char *name;
+	char *device;
+	uint64_t size;
+	int mode;
+} tmp_mapping;
+static unsigned int tmp_mapping_seq = 0;
 static int devfd=-1;
+static int stale_checked = 0;
+
+/* Application signal handlers, restored when mapping is released */
+static struct sigaction old_sigint, old_sigterm;
+static int handlers_installed = 0;
 
 static int setup_mapping(const char *cipher, const char *name,
 			 const char *device,
 			 struct volume_key *vk,
 			 unsigned int sector, size_t srcLength,
-			 int mode, struct crypt_device *ctx)
+			 int mode, int reload, struct crypt_device *ctx)
 {
 	int device_sector_size = sector_size_for_device(device);
 	struct crypt_dm_active_device dmd = {
@@ -77,21 +96,73 @@ static int setup_mapping(const char *cipher, const char *name,
 	}
 
 	dmd.size = round_up_modulo(srcLength,device_sector_size)/SECTOR_SIZE;
-	cleaner_size = dmd.size;
+	tmp_mapping.size = dmd.size;
 
-	return dm_create_device(name, "TEMP", &dmd, 0);
+	return dm_create_device(name, "TEMP", &dmd, reload);
 }
 
-static void sigint_handler(int sig __attribute__((unused)))
+static void _restore_handlers(void)
+{
+	if (!handlers_installed)
+		return;
+
+	sigaction(SIGINT, &old_sigint, NULL);
+	sigaction(SIGTERM, &old_sigterm, NULL);
+	handlers_installed = 0;
+}
+
+/*
+ * Remove mapping and pass the signal to the handler the application had
+ * set before (signal is blocked here, it is delivered after return).
+ */
+static void sigint_handler(int sig)
 {
 	if(devfd >= 0)
 		close(devfd);
 	devfd = -1;
-	if(cleaner_name)
-		dm_remove_device(cleaner_name, 1, cleaner_size);
+	if(tmp_mapping.name)
+		dm_remove_temp_device(NULL, tmp_mapping.name, tmp_mapping.size);
 
-	signal(SIGINT, SIG_DFL);
-	kill(getpid(), SIGINT);
+	_restore_handlers();
+	raise(sig);
+}
+
+static void _install_handlers(void)
+{
+	struct sigaction sa;
+
+	if (handlers_installed)
+		return;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigint_handler;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGINT, &sa, &old_sigint);
+	sigaction(SIGTERM, &sa, &old_sigterm);
+	handlers_installed = 1;
+}
+
+static void _tmp_mapping_free(void)
+{
+	_restore_handlers();
+	free(tmp_mapping.name);
+	free(tmp_mapping.device);
+	memset(&tmp_mapping, 0, sizeof(tmp_mapping));
+}
+
+void LUKS_keyslot_mapping_release(struct crypt_device *ctx)
+{
+	struct timespec start;
+
+	if (!tmp_mapping.name)
+		return;
+
+	crypt_timing_start(ctx, &start);
+	dm_remove_temp_device(ctx, tmp_mapping.name, tmp_mapping.size);
+	crypt_timing_end(ctx, &start, "keyslot_unmap", -1, 0, 0);
+
+	_tmp_mapping_free();
 }
 
 static const char *_error_hint(char *cipherMode, size_t keyLength)
@@ -130,68 +201,105 @@ static int LUKS_endec_template(char *src, size_t srcLength,
 			       struct volume_key *vk,
 			       const char *device,
 			       unsigned int sector,
+			       int keyslot,
 			       ssize_t (*func)(int, void *, size_t),
 			       int mode,
 			       struct crypt_device *ctx)
 {
-	char *name = NULL;
 	char *fullpath = NULL;
 	char *dmCipherSpec = NULL;
 	const char *dmDir = dm_get_dir();
-	int r = -1;
+	struct timespec start;
+	int r = -1, reload, mapped;
 
 	if(dmDir == NULL) {
 		log_err(ctx, _("Failed to obtain device mapper directory."));
 		return -1;
 	}
-	if(asprintf(&name,"temporary-cryptsetup-%d",getpid())               == -1 ||
-	   asprintf(&fullpath,"%s/%s",dmDir,name)                           == -1 ||
-	   asprintf(&dmCipherSpec,"%s-%s",hdr->cipherName, hdr->cipherMode) == -1) {
-	        r = -ENOMEM;
-		goto out1;
-        }
 
-	signal(SIGINT, sigint_handler);
-	cleaner_name = name;
+	/* Mapping of another device or with different access mode is not reused */
+	reload = tmp_mapping.name && tmp_mapping.mode == mode &&
+		 !strcmp(tmp_mapping.device, device);
+	if (tmp_mapping.name && !reload)
+		LUKS_keyslot_mapping_release(ctx);
+	mapped = reload;
+
+	if (!reload) {
+		/* Remove mappings left by killed processes, only once */
+		if (!stale_checked) {
+			dm_remove_stale_temp_devices(TEMP_MAPPING_PREFIX);
+			stale_checked = 1;
+		}
 
-	r = setup_mapping(dmCipherSpec, name, device,
-			  vk, sector, srcLength, mode, ctx);
+		if (asprintf(&tmp_mapping.name, TEMP_MAPPING_PREFIX "%d-%u",
+			     getpid(), tmp_mapping_seq++) == -1) {
+			tmp_mapping.name = NULL;
+			return -ENOMEM;
+		}
+		tmp_mapping.device = strdup(device);
+		if (!tmp_mapping.device) {
+			_tmp_mapping_free();
+			return -ENOMEM;
+		}
+		tmp_mapping.mode = mode;
+
+		_install_handlers();
+	}
+
+	if(asprintf(&fullpath,"%s/%s",dmDir,tmp_mapping.name)              == -1 ||
+	   asprintf(&dmCipherSpec,"%s-%s",hdr->cipherName, hdr->cipherMode) == -1) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	/* Temporary mapping includes udev synchronisation */
+	log_dbg("%s temporary keyslot mapping %s.", reload ? "Reloading" : "Creating",
+		tmp_mapping.name);
+	crypt_timing_start(ctx, &start);
+	r = setup_mapping(dmCipherSpec, tmp_mapping.name, device,
+			  vk, sector, srcLength, mode, reload, ctx);
+	crypt_timing_end(ctx, &start, "keyslot_map", keyslot, 0, 0);
 	if(r < 0) {
 		log_err(ctx, _("Failed to setup dm-crypt key mapping for device %s.\n"
 			"Check that kernel supports %s cipher (check syslog for more info).\n%s"),
 			device, dmCipherSpec,
 			_error_hint(hdr->cipherMode, vk->keylength * 8));
 		r = -EIO;
-		goto out1;
+		goto out;
 	}
+	mapped = 1;
 
 	devfd = open(fullpath, mode | O_DIRECT | O_SYNC);  /* devfd is a global var */
 	if(devfd == -1) {
 		log_err(ctx, _("Failed to open temporary keystore device.\n"));
 		r = -EIO;
-		goto out2;
+		goto out;
 	}
 
+	crypt_timing_start(ctx, &start);
 	r = func(devfd,src,srcLength);
 	if(r < 0) {
 		log_err(ctx, _("Failed to access temporary keystore device.\n"));
 		r = -EIO;
-		goto out3;
-	}
+	} else if (mode == O_RDONLY)
+		crypt_timing_end(ctx, &start, "keyslot_read", keyslot, srcLength, 0);
+	else
+		crypt_timing_end(ctx, &start, "keyslot_write", keyslot, 0, srcLength);
 
-	r = 0;
- out3:
 	close(devfd);
 	devfd = -1;
- out2:
-	dm_remove_device(cleaner_name, 1, cleaner_size);
- out1:
-	signal(SIGINT, SIG_DFL);
-	cleaner_name = NULL;
-	cleaner_size = 0;
+	if (r >= 0)
+		r = 0;
+ out:
+	/* Never keep mapping in unknown state */
+	if (r < 0) {
+		if (mapped)
+			LUKS_keyslot_mapping_release(ctx);
+		else
+			_tmp_mapping_free();
+	}
 	free(dmCipherSpec);
 	free(fullpath);
-	free(name);
 	return r;
 }
 
@@ -200,10 +308,11 @@ int LUKS_encrypt_to_storage(char *src, size_t srcLength,
 			    struct volume_key *vk,
 			    const char *device,
 			    unsigned int sector,
+			    int keyslot,
 			    struct crypt_device *ctx)
 {
 	return LUKS_endec_template(src,srcLength,hdr,vk, device,
-				   sector, write_blockwise, O_RDWR, ctx);
+				   sector, keyslot, write_blockwise, O_RDWR, ctx);
 }
 
 int LUKS_decrypt_from_storage(char *dst, size_t dstLength,
@@ -211,8 +320,9 @@ int LUKS_decrypt_from_storage(char *dst, size_t dstLength,
 			      struct volume_key *vk,
 			      const char *device,
 			      unsigned int sector,
+			      int keyslot,
 			      struct crypt_device *ctx)
 {
 	return LUKS_endec_template(dst,dstLength,hdr,vk, device,
-				   sector, read_blockwise, O_RDONLY, ctx);
+				   sector, keyslot, read_blockwise, O_RDONLY, ctx);
 }
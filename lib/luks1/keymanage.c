@@ -231,8 +231,16 @@ static int _check_and_convert_hdr(const char *device,
 	int r = 0;
 	unsigned int i;
 	char luksMagic[] = LUKS_MAGIC;
+	char reencryptMagic[] = LUKS_REENCRYPT_MAGIC;
 
-	if(memcmp(hdr->magic, luksMagic, LUKS_MAGIC_L)) { /* Check magic */
+	if (!memcmp(hdr->magic, reencryptMagic, LUKS_MAGIC_L)) {
+		log_dbg("LUKS header marked by online reencryption.");
+		if (require_luks_device)
+			log_err(ctx, _("Device %s is being reencrypted, run cryptsetup-reencrypt to finish it.\n"), device);
+		else
+			set_error(_("Device %s is being reencrypted."), device);
+		r = -EBUSY;
+	} else if(memcmp(hdr->magic, luksMagic, LUKS_MAGIC_L)) { /* Check magic */
 		log_dbg("LUKS header not detected.");
 		if (require_luks_device)
 			log_err(ctx, _("Device %s is not a valid LUKS device.\n"), device);
@@ -275,6 +283,46 @@ static void LUKS_fix_header_compatible(struct luks_phdr *header)
 	_to_lower(header->hashSpec, LUKS_HASHSPEC_L);
 }
 
+/*
+ * Lightweight header check, only the first sector is read and converted.
+ * It does not need crypto backend nor crypt context and uses no global state.
+ */
+int LUKS_probe_phdr(const char *device, struct luks_phdr *hdr)
+{
+	char luksMagic[] = LUKS_MAGIC;
+	char reencryptMagic[] = LUKS_REENCRYPT_MAGIC;
+	ssize_t r;
+	int devfd;
+
+	memset(hdr, 0, sizeof(*hdr));
+
+	devfd = open(device, O_RDONLY);
+	if (devfd == -1)
+		return -errno;
+
+	r = pread(devfd, hdr, SECTOR_SIZE, 0);
+	close(devfd);
+
+	if (r != SECTOR_SIZE)
+		return -EIO;
+
+	if ((memcmp(hdr->magic, luksMagic, LUKS_MAGIC_L) &&
+	     memcmp(hdr->magic, reencryptMagic, LUKS_MAGIC_L)) ||
+	    ntohs(hdr->version) != 1)
+		return -EINVAL;
+
+	hdr->version            = 1;
+	hdr->payloadOffset      = ntohl(hdr->payloadOffset);
+	hdr->keyBytes           = ntohl(hdr->keyBytes);
+	hdr->mkDigestIterations = ntohl(hdr->mkDigestIterations);
+
+	/* Header is converted, reencryption tool still needs its UUID */
+	if (!memcmp(hdr->magic, reencryptMagic, LUKS_MAGIC_L))
+		return -EBUSY;
+
+	return 0;
+}
+
 int LUKS_read_phdr_backup(const char *backup_file,
 			  const char *device,
 			  struct luks_phdr *hdr,
@@ -310,11 +358,14 @@ int LUKS_read_phdr(const char *device,
 		   struct crypt_device *ctx)
 {
 	ssize_t hdr_size = sizeof(struct luks_phdr);
+	struct timespec start;
 	int devfd = 0, r = 0;
 
 	log_dbg("Reading LUKS header of size %d from device %s",
 		hdr_size, device);
 
+	crypt_probe1(header__read, device);
+	crypt_timing_start(ctx, &start);
 	devfd = open(device,O_RDONLY | O_DIRECT | O_SYNC);
 	if(-1 == devfd) {
 		log_err(ctx, _("Cannot open device %s.\n"), device);
@@ -327,6 +378,7 @@ int LUKS_read_phdr(const char *device,
 		r = _check_and_convert_hdr(device, hdr, require_luks_device, ctx);
 
 	close(devfd);
+	crypt_timing_end(ctx, &start, "header_read", -1, hdr_size, 0);
 	return r;
 }
 
@@ -338,11 +390,14 @@ int LUKS_write_phdr(const char *device,
 	int devfd = 0;
 	unsigned int i;
 	struct luks_phdr convHdr;
+	struct timespec start;
 	int r;
 
 	log_dbg("Updating LUKS header of size %d on device %s",
 		sizeof(struct luks_phdr), device);
 
+	crypt_probe1(header__write, device);
+	crypt_timing_start(ctx, &start);
 	devfd = open(device,O_RDWR | O_DIRECT | O_SYNC);
 	if(-1 == devfd) {
 		log_err(ctx, _("Cannot open device %s.\n"), device);
@@ -368,6 +423,7 @@ int LUKS_write_phdr(const char *device,
 	if (r)
 		log_err(ctx, _("Error during update of LUKS header on device %s.\n"), device);
 	close(devfd);
+	crypt_timing_end(ctx, &start, "header_write", -1, 0, hdr_size);
 
 	/* Re-read header from disk to be sure that in-memory and on-disk data are the same. */
 	if (!r) {
@@ -383,11 +439,15 @@ static int LUKS_PBKDF2_performance_check(const char *hashSpec,
 					 uint64_t *PBKDF2_per_sec,
 					 struct crypt_device *ctx)
 {
+	struct timespec start;
+
 	if (!*PBKDF2_per_sec) {
+		crypt_timing_start(ctx, &start);
 		if (PBKDF2_performance_check(hashSpec, PBKDF2_per_sec) < 0) {
 			log_err(ctx, _("Not compatible PBKDF2 options (using hash algorithm %s).\n"), hashSpec);
 			return -EINVAL;
 		}
+		crypt_timing_end(ctx, &start, "pbkdf2_benchmark", -1, 0, 0);
 		log_dbg("PBKDF2: %" PRIu64 " iterations per second using hash %s.", *PBKDF2_per_sec, hashSpec);
 	}
 
@@ -407,6 +467,7 @@ int LUKS_generate_phdr(struct luks_phdr *header,
 {
 	unsigned int i=0;
 	unsigned int blocksPerStripeSet = div_round_up(vk->keylength*stripes,SECTOR_SIZE);
+	struct timespec start;
 	int r;
 	uuid_t partitionUuid;
 	int currentSector;
@@ -459,10 +520,12 @@ int LUKS_generate_phdr(struct luks_phdr *header,
 	header->mkDigestIterations = at_least((uint32_t)(*PBKDF2_per_sec/1024) * iteration_time_ms,
 					      LUKS_MKD_ITERATIONS_MIN);
 
+	crypt_timing_start(ctx, &start);
 	r = PBKDF2_HMAC(header->hashSpec,vk->key,vk->keylength,
 			header->mkDigestSalt,LUKS_SALTSIZE,
 			header->mkDigestIterations,
 			header->mkDigest,LUKS_DIGESTSIZE);
+	crypt_timing_end(ctx, &start, "digest", -1, 0, 0);
 	if(r < 0) {
 		log_err(ctx,  _("Cannot create LUKS header: header digest failed (using hash %s).\n"),
 			header->hashSpec);
@@ -515,6 +578,38 @@ int LUKS_hdr_uuid_set(
 	return LUKS_write_phdr(device, hdr, ctx);
 }
 
+/*
+ * Derived key and AF stripes of keyslot are placed in context workspace
+ * (secure memory), repeated keyslot operations do not allocate.
+ */
+static int LUKS_keyslot_workspace(struct crypt_device *ctx,
+				  const struct luks_phdr *hdr,
+				  unsigned int keyIndex,
+				  struct volume_key **derived_key,
+				  char **AfKey, size_t *AFEKSize,
+				  size_t *ws_size)
+{
+	size_t vk_size;
+	char *ws;
+
+	/* keep AF buffer aligned */
+	vk_size = sizeof(struct volume_key) + hdr->keyBytes;
+	vk_size = (vk_size + 15) & ~(size_t)15;
+
+	*AFEKSize = (size_t)hdr->keyblock[keyIndex].stripes * hdr->keyBytes;
+	*ws_size = vk_size + *AFEKSize;
+
+	ws = crypt_workspace(ctx, *ws_size);
+	if (!ws)
+		return -ENOMEM;
+
+	*derived_key = (struct volume_key *)ws;
+	(*derived_key)->keylength = hdr->keyBytes;
+	*AfKey = ws + vk_size;
+
+	return 0;
+}
+
 int LUKS_set_key(const char *device, unsigned int keyIndex,
 		 const char *password, size_t passwordLen,
 		 struct luks_phdr *hdr, struct volume_key *vk,
@@ -522,10 +617,11 @@ int LUKS_set_key(const char *device, unsigned int keyIndex,
 		 uint64_t *PBKDF2_per_sec,
 		 struct crypt_device *ctx)
 {
-	struct volume_key *derived_key;
+	struct volume_key *derived_key = NULL;
 	char *AfKey = NULL;
-	unsigned int AFEKSize;
+	size_t AFEKSize, ws_size = 0;
 	uint64_t PBKDF2_temp;
+	struct timespec start;
 	int r;
 
 	if(hdr->keyblock[keyIndex].active != LUKS_KEY_DISABLED) {
@@ -557,36 +653,38 @@ int LUKS_set_key(const char *device, unsigned int keyIndex,
 
 	log_dbg("Key slot %d use %d password iterations.", keyIndex, hdr->keyblock[keyIndex].passwordIterations);
 
-	derived_key = crypt_alloc_volume_key(hdr->keyBytes, NULL);
-	if (!derived_key)
-		return -ENOMEM;
+	assert(vk->keylength == hdr->keyBytes);
+	r = LUKS_keyslot_workspace(ctx, hdr, keyIndex, &derived_key,
+				   &AfKey, &AFEKSize, &ws_size);
+	if (r < 0)
+		return r;
 
 	r = crypt_random_get(ctx, hdr->keyblock[keyIndex].passwordSalt,
 		       LUKS_SALTSIZE, CRYPT_RND_NORMAL);
 	if (r < 0)
-		return r;
+		goto out;
 
+	crypt_probe3(pbkdf2__start, device, keyIndex,
+		     hdr->keyblock[keyIndex].passwordIterations);
+	crypt_timing_start(ctx, &start);
 	r = PBKDF2_HMAC(hdr->hashSpec, password,passwordLen,
 			hdr->keyblock[keyIndex].passwordSalt,LUKS_SALTSIZE,
 			hdr->keyblock[keyIndex].passwordIterations,
 			derived_key->key, hdr->keyBytes);
+	crypt_timing_end(ctx, &start, "pbkdf2", keyIndex, 0, 0);
+	crypt_probe4(pbkdf2__done, device, keyIndex,
+		     hdr->keyblock[keyIndex].passwordIterations, r);
 	if (r < 0)
 		goto out;
 
 	/*
 	 * AF splitting, the masterkey stored in vk->key is split to AfKey
 	 */
-	assert(vk->keylength == hdr->keyBytes);
-	AFEKSize = hdr->keyblock[keyIndex].stripes*vk->keylength;
-	AfKey = crypt_safe_alloc(AFEKSize);
-	if (!AfKey) {
-		r = -ENOMEM;
-		goto out;
-	}
-
 	log_dbg("Using hash %s for AF in key slot %d, %d stripes",
 		hdr->hashSpec, keyIndex, hdr->keyblock[keyIndex].stripes);
+	crypt_timing_start(ctx, &start);
 	r = AF_split(vk->key,AfKey,vk->keylength,hdr->keyblock[keyIndex].stripes,hdr->hashSpec);
+	crypt_timing_end(ctx, &start, "af_split", keyIndex, 0, 0);
 	if (r < 0)
 		goto out;
 
@@ -599,7 +697,8 @@ int LUKS_set_key(const char *device, unsigned int keyIndex,
 				    derived_key,
 				    device,
 				    hdr->keyblock[keyIndex].keyMaterialOffset,
-				    ctx);
+				    keyIndex, ctx);
+	LUKS_keyslot_mapping_release(ctx);
 	if (r < 0) {
 		if(!get_error())
 			log_err(ctx, _("Failed to write to key storage.\n"));
@@ -617,8 +716,7 @@ int LUKS_set_key(const char *device, unsigned int keyIndex,
 
 	r = 0;
 out:
-	crypt_safe_free(AfKey);
-	crypt_free_volume_key(derived_key);
+	memset(derived_key, 0, ws_size);
 	return r;
 }
 
@@ -652,7 +750,8 @@ static int LUKS_open_key(const char *device,
 	crypt_keyslot_info ki = LUKS_keyslot_info(hdr, keyIndex);
 	struct volume_key *derived_key;
 	char *AfKey;
-	size_t AFEKSize;
+	size_t AFEKSize, ws_size;
+	struct timespec start;
 	int r;
 
 	log_dbg("Trying to open key slot %d [%s].", keyIndex,
@@ -661,20 +760,24 @@ static int LUKS_open_key(const char *device,
 	if (ki < CRYPT_SLOT_ACTIVE)
 		return -ENOENT;
 
-	derived_key = crypt_alloc_volume_key(hdr->keyBytes, NULL);
-	if (!derived_key)
-		return -ENOMEM;
+	crypt_probe2(keyslot__try, device, keyIndex);
 
 	assert(vk->keylength == hdr->keyBytes);
-	AFEKSize = hdr->keyblock[keyIndex].stripes*vk->keylength;
-	AfKey = crypt_safe_alloc(AFEKSize);
-	if (!AfKey)
-		return -ENOMEM;
+	r = LUKS_keyslot_workspace(ctx, hdr, keyIndex, &derived_key,
+				   &AfKey, &AFEKSize, &ws_size);
+	if (r < 0)
+		return r;
 
+	crypt_probe3(pbkdf2__start, device, keyIndex,
+		     hdr->keyblock[keyIndex].passwordIterations);
+	crypt_timing_start(ctx, &start);
 	r = PBKDF2_HMAC(hdr->hashSpec, password,passwordLen,
 			hdr->keyblock[keyIndex].passwordSalt,LUKS_SALTSIZE,
 			hdr->keyblock[keyIndex].passwordIterations,
 			derived_key->key, hdr->keyBytes);
+	crypt_timing_end(ctx, &start, "pbkdf2", keyIndex, 0, 0);
+	crypt_probe4(pbkdf2__done, device, keyIndex,
+		     hdr->keyblock[keyIndex].passwordIterations, r);
 	if (r < 0)
 		goto out;
 
@@ -685,22 +788,26 @@ static int LUKS_open_key(const char *device,
 				      derived_key,
 				      device,
 				      hdr->keyblock[keyIndex].keyMaterialOffset,
-				      ctx);
+				      keyIndex, ctx);
 	if (r < 0) {
 		log_err(ctx, _("Failed to read from key storage.\n"));
 		goto out;
 	}
 
+	crypt_timing_start(ctx, &start);
 	r = AF_merge(AfKey,vk->key,vk->keylength,hdr->keyblock[keyIndex].stripes,hdr->hashSpec);
+	crypt_timing_end(ctx, &start, "af_merge", keyIndex, 0, 0);
 	if (r < 0)
 		goto out;
 
+	crypt_timing_start(ctx, &start);
 	r = LUKS_verify_volume_key(hdr, vk);
+	crypt_timing_end(ctx, &start, "verify", keyIndex, 0, 0);
 	if (!r)
 		log_verbose(ctx, _("Key slot %d unlocked.\n"), keyIndex);
 out:
-	crypt_safe_free(AfKey);
-	crypt_free_volume_key(derived_key);
+	crypt_probe3(keyslot__done, device, keyIndex, r);
+	memset(derived_key, 0, ws_size);
 	return r;
 }
 
@@ -716,23 +823,32 @@ int LUKS_open_key_with_hdr(const char *device,
 	int r;
 
 	*vk = crypt_alloc_volume_key(hdr->keyBytes, NULL);
+	if (!*vk)
+		return -ENOMEM;
 
 	if (keyIndex >= 0) {
 		r = LUKS_open_key(device, keyIndex, password, passwordLen, hdr, *vk, ctx);
+		LUKS_keyslot_mapping_release(ctx);
 		return (r < 0) ? r : keyIndex;
 	}
 
+	/* All keyslots share one temporary mapping, released at the end */
 	for(i = 0; i < LUKS_NUMKEYS; i++) {
 		r = LUKS_open_key(device, i, password, passwordLen, hdr, *vk, ctx);
-		if(r == 0)
+		if(r == 0) {
+			LUKS_keyslot_mapping_release(ctx);
 			return i;
+		}
 
 		/* Do not retry for errors that are no -EPERM or -ENOENT,
 		   former meaning password wrong, latter key slot inactive */
-		if ((r != -EPERM) && (r != -ENOENT))
+		if ((r != -EPERM) && (r != -ENOENT)) {
+			LUKS_keyslot_mapping_release(ctx);
 			return r;
+		}
 	}
 	/* Warning, early returns above */
+	LUKS_keyslot_mapping_release(ctx);
 	log_err(ctx, _("No key available with this passphrase.\n"));
 	return -EPERM;
 }
@@ -789,6 +905,7 @@ static int wipe(const char *device, unsigned int from, unsigned int to)
 							    CRYPT_RND_NORMAL);
 		else if(i >= 38 && i < 39) memset(buffer, 0xFF, bufLen);
 
+		crypt_probe4(wipe__pass, device, from, to, i);
 		written = write_lseek_blockwise(devfd, buffer, bufLen,
 						from * SECTOR_SIZE);
 		if (written < 0 || written != bufLen) {
@@ -906,6 +1023,8 @@ int LUKS1_activate(struct crypt_device *cd,
 {
 	int r;
 	char *dm_cipher = NULL;
+	enum devcheck device_check = DEV_EXCL;
+	struct timespec start;
 	struct crypt_dm_active_device dmd = {
 		.device = crypt_get_device_name(cd),
 		.cipher = NULL,
@@ -917,7 +1036,11 @@ int LUKS1_activate(struct crypt_device *cd,
 		.flags  = flags
 	};
 
-	r = device_check_and_adjust(cd, dmd.device, DEV_EXCL,
+	/* Private mappings (reencryption) can overlap each other */
+	if ((flags & CRYPT_ACTIVATE_PRIVATE) && (flags & CRYPT_ACTIVATE_SHARED))
+		device_check = DEV_OK;
+
+	r = device_check_and_adjust(cd, dmd.device, device_check,
 				    &dmd.size, &dmd.offset, &flags);
 	if (r)
 		return r;
@@ -927,7 +1050,10 @@ int LUKS1_activate(struct crypt_device *cd,
 		return -ENOMEM;
 
 	dmd.cipher = dm_cipher;
-	r = dm_create_device(name, CRYPT_LUKS1, &dmd, 0);
+	crypt_timing_start(cd, &start);
+	r = dm_create_device(name, (flags & CRYPT_ACTIVATE_PRIVATE) ? "TEMP" : CRYPT_LUKS1,
+			     &dmd, 0);
+	crypt_timing_end(cd, &start, "activate", -1, 0, 0);
 
 	free(dm_cipher);
 	return r;
@@ -31,6 +31,9 @@
 #define LUKS_MAGIC {'L','U','K','S', 0xba, 0xbe};
 #define LUKS_MAGIC_L 6
 
+// header of device in online reencryption, must not be activated
+#define LUKS_REENCRYPT_MAGIC {'S','K','U','L', 0xba, 0xbe};
+
 #define LUKS_PHDR_SIZE (sizeof(struct luks_phdr)/SECTOR_SIZE+1)
 
 /* Actually we need only 37, but we don't want struct autoaligning to kick in */
@@ -97,6 +100,10 @@ int LUKS_read_phdr(
 	int require_luks_device,
 	struct crypt_device *ctx);
 
+int LUKS_probe_phdr(
+	const char *device,
+	struct luks_phdr *hdr);
+
 int LUKS_read_phdr_backup(
 	const char *backup_file,
 	const char *device,
@@ -164,6 +171,7 @@ int LUKS_encrypt_to_storage(
 	struct volume_key *vk,
 	const char *device,
 	unsigned int sector,
+	int keyslot,
 	struct crypt_device *ctx);
 
 int LUKS_decrypt_from_storage(
@@ -172,8 +180,12 @@ int LUKS_decrypt_from_storage(
 	struct volume_key *vk,
 	const char *device,
 	unsigned int sector,
+	int keyslot,
 	struct crypt_device *ctx);
 
+/* Remove temporary mapping kept by previous keyslot access */
+void LUKS_keyslot_mapping_release(struct crypt_device *ctx);
+
 int LUKS1_activate(struct crypt_device *cd,
 		   const char *name,
 		   struct volume_key *vk,
@@ -26,8 +26,6 @@
 #include "libcryptsetup.h"
 #include "internal.h"
 
-static int random_initialised = 0;
-
 #define URANDOM_DEVICE	"/dev/urandom"
 static int urandom_fd = -1;
 
@@ -40,15 +38,36 @@ static int random_fd = -1;
 /* Timeout to print warning if no random data (entropy) */
 #define RANDOM_DEVICE_TIMEOUT	5
 
+/*
+ * RNG devices are opened on first use, descriptor is the state.
+ * Read-only operations (header load or dump) never touch RNG.
+ */
+static int _open_rng(struct crypt_device *ctx, int *fd,
+		     const char *device, int flags)
+{
+	if (*fd != -1)
+		return 0;
+
+	*fd = open(device, flags);
+	if (*fd == -1) {
+		log_err(ctx, _("Fatal error during RNG initialisation.\n"));
+		return -ENOSYS;
+	}
+
+	log_dbg("RNG device %s opened.", device);
+	return 0;
+}
+
 /* URANDOM_DEVICE access */
-static int _get_urandom(struct crypt_device *ctx __attribute__((unused)),
-			char *buf, size_t len)
+static int _get_urandom(struct crypt_device *ctx, char *buf, size_t len)
 {
 	int r;
 	size_t old_len = len;
 	char *old_buf = buf;
 
-	assert(urandom_fd != -1);
+	/* Used for CRYPT_RND_NORMAL */
+	if (_open_rng(ctx, &urandom_fd, URANDOM_DEVICE, O_RDONLY))
+		return -ENOSYS;
 
 	while(len) {
 		r = read(urandom_fd, buf, len);
@@ -88,7 +107,9 @@ static int _get_random(struct crypt_device *ctx, char *buf, size_t len)
 	fd_set fds;
 	struct timeval tv;
 
-	assert(random_fd != -1);
+	/* Used for CRYPT_RND_KEY */
+	if (_open_rng(ctx, &random_fd, RANDOM_DEVICE, O_RDONLY | O_NONBLOCK))
+		return -ENOSYS;
 
 	while (len) {
 		FD_ZERO(&fds);
@@ -142,30 +163,19 @@ static int _get_random(struct crypt_device *ctx, char *buf, size_t len)
 
 	return 0;
 }
-/* Initialisation of both RNG file descriptors is mandatory */
+/*
+ * Explicit (eager) initialisation of both RNG file descriptors,
+ * otherwise RNG is opened on the first crypt_random_get() call.
+ */
 int crypt_random_init(struct crypt_device *ctx)
 {
-	if (random_initialised)
-		return 0;
-
-	/* Used for CRYPT_RND_NORMAL */
-	if(urandom_fd == -1)
-		urandom_fd = open(URANDOM_DEVICE, O_RDONLY);
-	if(urandom_fd == -1)
-		goto fail;
-
-	/* Used for CRYPT_RND_KEY */
-	if(random_fd == -1)
-		random_fd = open(RANDOM_DEVICE, O_RDONLY | O_NONBLOCK);
-	if(random_fd == -1)
-		goto fail;
+	if (_open_rng(ctx, &urandom_fd, URANDOM_DEVICE, O_RDONLY) ||
+	    _open_rng(ctx, &random_fd, RANDOM_DEVICE, O_RDONLY | O_NONBLOCK)) {
+		crypt_random_exit();
+		return -ENOSYS;
+	}
 
-	random_initialised = 1;
 	return 0;
-fail:
-	crypt_random_exit();
-	log_err(ctx, _("Fatal error during RNG initialisation.\n"));
-	return -ENOSYS;
 }
 
 int crypt_random_get(struct crypt_device *ctx, char *buf, size_t len, int quality)
@@ -195,6 +205,9 @@ int crypt_random_get(struct crypt_device *ctx, char *buf, size_t len, int qualit
 		return -EINVAL;
 	}
 
+	if (status == -ENOSYS)
+		return status;
+
 	if (status)
 		log_err(ctx, _("Error %d reading from RNG: %s\n"),
 			errno, strerror(errno));
@@ -204,8 +217,6 @@ int crypt_random_get(struct crypt_device *ctx, char *buf, size_t len, int qualit
 
 void crypt_random_exit(void)
 {
-	random_initialised = 0;
-
 	if(random_fd != -1) {
 		(void)close(random_fd);
 		random_fd = -1;
@@ -25,6 +25,7 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "libcryptsetup.h"
 #include "luks.h"
@@ -32,6 +33,9 @@
 #include "internal.h"
 #include "crypto_backend.h"
 
+/* attempts to get free loop device if it is taken by another process */
+#define LOOP_ATTACH_TRIES 8
+
 struct crypt_device {
 	char *type;
 
@@ -40,6 +44,7 @@ struct crypt_device {
 
 	char *backing_file;
 	int loop_fd;
+	char *image_file;	/* regular file, loop not yet attached */
 	struct volume_key *volume_key;
 	uint64_t timeout;
 	uint64_t iteration_time;
@@ -47,6 +52,10 @@ struct crypt_device {
 	int password_verify;
 	int rng_type;
 
+	/* secure scratch buffer for keyslot processing */
+	char *workspace;
+	size_t workspace_size;
+
 	/* used in CRYPT_LUKS1 */
 	struct luks_phdr hdr;
 	uint64_t PBKDF2_per_sec;
@@ -71,6 +80,8 @@ struct crypt_device {
 	void *confirm_usrptr;
 	int (*password)(const char *msg, char *buf, size_t length, void *usrptr);
 	void *password_usrptr;
+	void (*timing)(const struct crypt_timing *timing, void *usrptr);
+	void *timing_usrptr;
 };
 
 /* Log helper */
@@ -125,16 +136,15 @@ static const char *mdata_device(struct crypt_device *cd)
 	return cd->metadata_device ?: cd->device;
 }
 
-static int init_crypto(struct crypt_device *ctx)
+/*
+ * Only crypto backend is initialised here (header checks need hash support),
+ * RNG is opened on first use and device-mapper kernel support is checked
+ * before the first device-mapper table is loaded.
+ */
+int init_crypto(struct crypt_device *ctx)
 {
 	int r;
 
-	r = crypt_random_init(ctx);
-	if (r < 0) {
-		log_err(ctx, _("Cannot initialize crypto RNG backend.\n"));
-		return r;
-	}
-
 	r = crypt_backend_init(ctx);
 	if (r < 0)
 		log_err(ctx, _("Cannot initialize crypto backend.\n"));
@@ -272,6 +282,30 @@ int crypt_confirm(struct crypt_device *cd, const char *msg)
 		return cd->confirm(msg, cd->confirm_usrptr);
 }
 
+/*
+ * Per context scratch buffer in secure memory. It only grows, so repeated
+ * keyslot operations do not allocate. Caller must wipe it after use.
+ */
+void *crypt_workspace(struct crypt_device *cd, size_t size)
+{
+	char *workspace;
+
+	if (!cd)
+		return NULL;
+
+	if (size > cd->workspace_size) {
+		workspace = crypt_safe_alloc(size);
+		if (!workspace)
+			return NULL;
+
+		crypt_safe_free(cd->workspace);
+		cd->workspace = workspace;
+		cd->workspace_size = size;
+	}
+
+	return cd->workspace;
+}
+
 static int key_from_terminal(struct crypt_device *cd, char *msg, char **key,
 			      size_t *key_len, int force_verify)
 {
@@ -353,6 +387,34 @@ static int key_from_file(struct crypt_device *cd, char *msg,
 			     cd->timeout, 0, cd);
 }
 
+/* GPG encrypted loop-AES keyfile is replaced by decrypted keys */
+static int loopaes_gpg_keyfile(struct crypt_device *cd,
+			       char **buffer, size_t *buffer_len)
+{
+	char *gpg_pass = NULL, *keys = NULL;
+	size_t gpg_pass_len, keys_len;
+	int r;
+
+	if (!LOOPAES_keyfile_is_gpg(*buffer, *buffer_len))
+		return 0;
+
+	r = key_from_terminal(cd, _("Enter passphrase for GPG keyfile: "),
+			      &gpg_pass, &gpg_pass_len, 0);
+	if (r < 0)
+		return r;
+
+	r = LOOPAES_gpg_decrypt(cd, gpg_pass, gpg_pass_len,
+				*buffer, *buffer_len, &keys, &keys_len);
+	crypt_safe_free(gpg_pass);
+	if (r < 0)
+		return r;
+
+	crypt_safe_free(*buffer);
+	*buffer = keys;
+	*buffer_len = keys_len;
+	return 0;
+}
+
 void crypt_set_log_callback(struct crypt_device *cd,
 	void (*log)(int level, const char *msg, void *usrptr),
 	void *usrptr)
@@ -381,6 +443,61 @@ void crypt_set_password_callback(struct crypt_device *cd,
 	cd->password_usrptr = usrptr;
 }
 
+void crypt_set_timing_callback(struct crypt_device *cd,
+	void (*timing)(const struct crypt_timing *timing, void *usrptr),
+	void *usrptr)
+{
+	cd->timing = timing;
+	cd->timing_usrptr = usrptr;
+}
+
+#ifdef USE_SDT
+/* Probe semaphores, tracer increments them when attaching to the probe */
+#define CRYPT_PROBE_DEFINE(n) \
+	unsigned short CRYPT_PROBE_SEMAPHORE(n) __attribute__((section(".probes")));
+CRYPT_PROBES(CRYPT_PROBE_DEFINE)
+#endif
+
+/*
+ * Clock is read only if somebody consumes the duration, zero start
+ * tells crypt_timing_end() to skip the phase.
+ */
+void crypt_timing_start(struct crypt_device *cd, struct timespec *start)
+{
+	if (((cd && cd->timing) || crypt_probe_enabled(phase)) &&
+	    !clock_gettime(CLOCK_MONOTONIC, start))
+		return;
+
+	memset(start, 0, sizeof(*start));
+}
+
+void crypt_timing_end(struct crypt_device *cd, const struct timespec *start,
+		      const char *phase, int keyslot,
+		      uint64_t bytes_read, uint64_t bytes_written)
+{
+	struct crypt_timing t = {
+		.phase = phase,
+		.keyslot = keyslot,
+		.bytes_read = bytes_read,
+		.bytes_written = bytes_written,
+	};
+	struct timespec end;
+
+	if (!start->tv_sec && !start->tv_nsec)
+		return;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &end) < 0)
+		return;
+
+	t.usec = (uint64_t)(end.tv_sec - start->tv_sec) * 1000000 +
+		 (end.tv_nsec - start->tv_nsec) / 1000;
+
+	crypt_probe5(phase, phase, keyslot, t.usec, bytes_read, bytes_written);
+
+	if (cd && cd->timing)
+		cd->timing(&t, cd->timing_usrptr);
+}
+
 void crypt_get_error(char *buf, size_t size)
 {
 	const char *error = get_error();
@@ -400,6 +517,93 @@ const char *crypt_get_dir(void)
 	return dm_get_dir();
 }
 
+/*
+ * Attach file to a free loop device. Another process can take the device
+ * between lookup and attach, then just try the next free one.
+ */
+static int _loop_attach_free(const char *file, char **loop, int *loop_fd,
+			     int *readonly)
+{
+	int tries;
+
+	for (tries = 0; tries < LOOP_ATTACH_TRIES; tries++) {
+		*loop = crypt_loop_get_device();
+		log_dbg("Not a block device, %s%s.",
+			*loop ? "using free loop device " :
+				 "no free loop device found",
+			*loop ?: "");
+		if (!*loop) {
+			log_err(NULL, _("Cannot find a free loopback device.\n"));
+			return -ENOSYS;
+		}
+
+		/* Keep the loop open, dettached on last close. */
+		*loop_fd = crypt_loop_attach(*loop, file, 0, 1, readonly);
+		if (*loop_fd != -1)
+			return 0;
+
+		if (errno != EBUSY)
+			break;
+
+		log_dbg("Loop device %s is busy, retrying.", *loop);
+		free(*loop);
+		*loop = NULL;
+	}
+
+	free(*loop);
+	*loop = NULL;
+	log_err(NULL, _("Attaching loopback device failed "
+		"(loop device with autoclear flag is required).\n"));
+	return -EINVAL;
+}
+
+/*
+ * Image file passed to crypt_init() is accessed directly for metadata
+ * operations, loop device is attached only when a block device is really
+ * needed (keyslot temporary mapping or activation).
+ */
+static int crypt_attach_image_file(struct crypt_device *cd)
+{
+	char *loop = NULL;
+	int use_device, use_metadata, loop_fd, readonly = 0, r;
+
+	if (!cd->image_file)
+		return 0;
+
+	use_device = cd->device && !strcmp(cd->device, cd->image_file);
+	use_metadata = cd->metadata_device &&
+		       !strcmp(cd->metadata_device, cd->image_file);
+
+	if (use_device || use_metadata) {
+		r = _loop_attach_free(cd->image_file, &loop, &loop_fd, &readonly);
+		if (r < 0)
+			return r;
+
+		if (use_metadata) {
+			free(cd->metadata_device);
+			cd->metadata_device = use_device ? strdup(loop) : loop;
+			if (!cd->metadata_device) {
+				close(loop_fd);
+				free(loop);
+				return -ENOMEM;
+			}
+		}
+
+		if (use_device) {
+			free(cd->device);
+			cd->device = loop;
+		}
+
+		cd->loop_fd = loop_fd;
+		free(cd->backing_file);
+		cd->backing_file = crypt_loop_backing_file(loop);
+	}
+
+	free(cd->image_file);
+	cd->image_file = NULL;
+	return 0;
+}
+
 int crypt_init(struct crypt_device **cd, const char *device)
 {
 	struct crypt_device *h = NULL;
@@ -418,26 +622,19 @@ int crypt_init(struct crypt_device **cd, const char *device)
 
 	if (device) {
 		r = device_ready(NULL, device, O_RDONLY);
-		if (r == -ENOTBLK) {
-			h->device = crypt_loop_get_device();
-			log_dbg("Not a block device, %s%s.",
-				h->device ? "using free loop device " :
-					 "no free loop device found",
-				h->device ?: "");
-			if (!h->device) {
-				log_err(NULL, _("Cannot find a free loopback device.\n"));
-				r = -ENOSYS;
+		if (r == -ENOTBLK && device_is_image_file(device)) {
+			log_dbg("Using image file %s directly, loop device "
+				"will be attached on demand.", device);
+			if (!(h->image_file = strdup(device))) {
+				r = -ENOMEM;
 				goto bad;
 			}
-
-			/* Keep the loop open, dettached on last close. */
-			h->loop_fd = crypt_loop_attach(h->device, device, 0, 1, &readonly);
-			if (h->loop_fd == -1) {
-				log_err(NULL, _("Attaching loopback device failed "
-					"(loop device with autoclear flag is required).\n"));
-				r = -EINVAL;
+			r = 0;
+		} else if (r == -ENOTBLK) {
+			r = _loop_attach_free(device, &h->device, &h->loop_fd,
+					      &readonly);
+			if (r < 0)
 				goto bad;
-			}
 
 			h->backing_file = crypt_loop_backing_file(h->device);
 			r = device_ready(NULL, h->device, O_RDONLY);
@@ -453,7 +650,7 @@ int crypt_init(struct crypt_device **cd, const char *device)
 		goto bad;
 	}
 
-	if (dm_init(h, 1) < 0) {
+	if (dm_init(h, 0) < 0) {
 		r = -ENOSYS;
 		goto bad;
 	}
@@ -471,6 +668,7 @@ bad:
 			close(h->loop_fd);
 		free(h->device);
 		free(h->backing_file);
+		free(h->image_file);
 	}
 	free(h);
 	return r;
@@ -881,6 +1079,43 @@ int crypt_load(struct crypt_device *cd,
 	return r;
 }
 
+static void _probe_strcpy(char *dst, const char *src, size_t dst_size, size_t src_size)
+{
+	size_t len = strnlen(src, src_size);
+
+	if (len >= dst_size)
+		len = dst_size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+int crypt_probe_luks1(const char *device, struct crypt_probe_luks1 *probe)
+{
+	struct luks_phdr hdr;
+	int r;
+
+	if (!device)
+		return -EINVAL;
+
+	r = LUKS_probe_phdr(device, &hdr);
+	log_dbg("Probing device %s for LUKS1 header: %s.", device,
+		r == 0 ? "found" : r == -EINVAL ? "not found" :
+		r == -EBUSY ? "reencryption in progress" : "read failed");
+	if ((r < 0 && r != -EBUSY) || !probe)
+		goto out;
+
+	memset(probe, 0, sizeof(*probe));
+	_probe_strcpy(probe->uuid, hdr.uuid, sizeof(probe->uuid), UUID_STRING_L);
+	_probe_strcpy(probe->cipher, hdr.cipherName, sizeof(probe->cipher), LUKS_CIPHERNAME_L);
+	_probe_strcpy(probe->cipher_mode, hdr.cipherMode, sizeof(probe->cipher_mode), LUKS_CIPHERMODE_L);
+	_probe_strcpy(probe->hash, hdr.hashSpec, sizeof(probe->hash), LUKS_HASHSPEC_L);
+	probe->volume_key_size = hdr.keyBytes;
+	probe->data_offset = hdr.payloadOffset;
+out:
+	memset(&hdr, 0, sizeof(hdr));
+	return r;
+}
+
 int crypt_resize(struct crypt_device *cd, const char *name, uint64_t new_size)
 {
 	struct crypt_dm_active_device dmd;
@@ -895,7 +1130,10 @@ int crypt_resize(struct crypt_device *cd, const char *name, uint64_t new_size)
 	r = dm_query_device(name, DM_ACTIVE_DEVICE | DM_ACTIVE_CIPHER |
 				  DM_ACTIVE_UUID | DM_ACTIVE_KEYSIZE |
 				  DM_ACTIVE_KEY, &dmd);
-	if (r < 0) {
+	if (r == -EBUSY) {
+		log_err(NULL, _("Device %s is being reencrypted.\n"), name);
+		goto out;
+	} else if (r < 0) {
 		log_err(NULL, _("Device %s is not active.\n"), name);
 		goto out;
 	}
@@ -997,12 +1235,14 @@ void crypt_free(struct crypt_device *cd)
 		if (cd->loop_fd != -1)
 			close(cd->loop_fd);
 
-		dm_exit();
+		dm_exit(cd);
 		crypt_free_volume_key(cd->volume_key);
+		crypt_safe_free(cd->workspace);
 
 		free(cd->device);
 		free(cd->metadata_device);
 		free(cd->backing_file);
+		free(cd->image_file);
 		free(cd->type);
 
 		/* used in plain device only */
@@ -1020,6 +1260,22 @@ void crypt_free(struct crypt_device *cd)
 	}
 }
 
+/*
+ * Table of device in online reencryption has more segments with different
+ * keys, key wipe or reinstate messages would break it.
+ */
+static int _check_not_reencrypted(struct crypt_device *cd, const char *name)
+{
+	struct crypt_dm_active_device dmd;
+	int r;
+
+	r = dm_query_device(name, 0, &dmd);
+	if (r == -EBUSY)
+		log_err(cd, _("Device %s is being reencrypted.\n"), name);
+
+	return r;
+}
+
 int crypt_suspend(struct crypt_device *cd,
 		  const char *name)
 {
@@ -1043,6 +1299,10 @@ int crypt_suspend(struct crypt_device *cd,
 	if (!cd && dm_init(NULL, 1) < 0)
 		return -ENOSYS;
 
+	r = _check_not_reencrypted(cd, name);
+	if (r < 0)
+		goto out;
+
 	r = dm_status_suspended(name);
 	if (r < 0)
 		goto out;
@@ -1060,7 +1320,7 @@ int crypt_suspend(struct crypt_device *cd,
 		log_err(cd, "Error during suspending device %s.\n", name);
 out:
 	if (!cd)
-		dm_exit();
+		dm_exit(NULL);
 	return r;
 }
 
@@ -1081,6 +1341,10 @@ int crypt_resume_by_passphrase(struct crypt_device *cd,
 		goto out;
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		goto out;
+
 	r = dm_status_suspended(name);
 	if (r < 0)
 		return r;
@@ -1090,6 +1354,10 @@ int crypt_resume_by_passphrase(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
+	r = _check_not_reencrypted(cd, name);
+	if (r < 0)
+		return r;
+
 	if (passphrase) {
 		r = LUKS_open_key_with_hdr(mdata_device(cd), keyslot, passphrase,
 					   passphrase_size, &cd->hdr, &vk, cd);
@@ -1129,6 +1397,10 @@ int crypt_resume_by_keyfile(struct crypt_device *cd,
 		goto out;
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		goto out;
+
 	r = dm_status_suspended(name);
 	if (r < 0)
 		return r;
@@ -1138,6 +1410,10 @@ int crypt_resume_by_keyfile(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
+	r = _check_not_reencrypted(cd, name);
+	if (r < 0)
+		return r;
+
 	if (!keyfile)
 		return -EINVAL;
 
@@ -1161,6 +1437,288 @@ out:
 	return r < 0 ? r : keyslot;
 }
 
+/*
+ * Online reencryption
+ *
+ * Active device is reloaded with up to three segments: already reencrypted
+ * area (new key), hotzone (linear mapping to separate device with old key)
+ * and not yet reencrypted area (old key). The hotzone device is suspended
+ * while its data are being rewritten, so only I/O to hotzone is blocked.
+ */
+static void _reencrypt_hotzone_name(const char *name, char *buf, size_t size)
+{
+	snprintf(buf, size, "temporary-cryptsetup-%s-hotzone", name);
+}
+
+static char *_reencrypt_cipher(struct crypt_device *cd)
+{
+	char *cipher;
+
+	if (asprintf(&cipher, "%s-%s", crypt_get_cipher(cd),
+		     crypt_get_cipher_mode(cd)) < 0)
+		return NULL;
+
+	return cipher;
+}
+
+/* Active device UUID is LUKS1-<uuid without dashes>-<name> */
+static int _reencrypt_check_uuid(struct crypt_device *cd, const char *dm_uuid)
+{
+	const char *uuid = crypt_get_uuid(cd);
+	size_t i, j = sizeof(CRYPT_LUKS1) - 1;
+
+	if (!uuid || !dm_uuid || strncmp(dm_uuid, CRYPT_LUKS1, j) ||
+	    dm_uuid[j++] != '-')
+		return -EINVAL;
+
+	for (i = 0; uuid[i]; i++) {
+		if (uuid[i] == '-')
+			continue;
+		if (dm_uuid[j++] != uuid[i])
+			return -EINVAL;
+	}
+
+	return dm_uuid[j] == '-' ? 0 : -EINVAL;
+}
+
+static int _reencrypt_hotzone_load(struct crypt_device *cd,
+				   struct crypt_device *hdr_cd,
+				   const char *hotzone,
+				   struct volume_key *vk,
+				   uint64_t offset,
+				   uint64_t length,
+				   uint32_t flags,
+				   int reload)
+{
+	struct crypt_dm_active_device dmd = {
+		.device = crypt_get_device_name(cd),
+		.cipher = NULL,
+		.uuid   = crypt_get_uuid(cd),
+		.vk     = vk,
+		.offset = crypt_get_data_offset(cd) + offset,
+		.iv_offset = offset,
+		.size   = length,
+		.flags  = flags
+	};
+	char *cipher;
+	int r;
+
+	cipher = _reencrypt_cipher(hdr_cd);
+	if (!cipher)
+		return -ENOMEM;
+
+	dmd.cipher = cipher;
+	log_dbg("Loading hotzone %s, offset %" PRIu64 ", size %" PRIu64 ", cipher %s.",
+		hotzone, offset, length, cipher);
+
+	r = dm_create_device(hotzone, "TEMP", &dmd, reload);
+
+	free(cipher);
+	return r;
+}
+
+int crypt_reencrypt_segments(struct crypt_device *cd,
+			     const char *name,
+			     struct crypt_params_reencrypt *params,
+			     uint64_t offset,
+			     uint64_t length)
+{
+	struct crypt_dm_active_device dmd, dmd_hz;
+	struct crypt_dm_segment segs[3];
+	struct volume_key *vk = NULL, *vk_new = NULL, *vk_hz = NULL;
+	struct crypt_device *cd_hz = NULL;
+	char hotzone[128], hotzone_path[PATH_MAX];
+	char *cipher = NULL, *cipher_new = NULL;
+	uint64_t size;
+	int hz_suspended, count = 0, r;
+
+	log_dbg("Switching reencryption segments of %s to offset %" PRIu64
+		", hotzone length %" PRIu64 ".", name, offset, length);
+
+	if (!isLUKS(cd->type) || !params || !params->cd_new ||
+	    !isLUKS(params->cd_new->type)) {
+		log_err(cd, _("This operation is supported only for LUKS device.\n"));
+		return -EINVAL;
+	}
+
+	if (crypt_get_data_offset(cd) != crypt_get_data_offset(params->cd_new)) {
+		log_err(cd, _("New LUKS header uses different data offset.\n"));
+		return -EINVAL;
+	}
+
+	r = dm_query_device(name, DM_ACTIVE_UUID | DM_ACTIVE_SEGMENTS, &dmd);
+	if (r < 0) {
+		log_err(cd, _("Volume %s is not active.\n"), name);
+		return r;
+	}
+	size = dmd.size;
+
+	if (_reencrypt_check_uuid(cd, dmd.uuid) < 0) {
+		log_err(cd, _("Device %s is not activated from %s.\n"),
+			name, crypt_get_device_name(cd));
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (offset > size || length > size - offset) {
+		log_err(cd, _("Reencryption window is outside of device %s.\n"), name);
+		r = -EINVAL;
+		goto out;
+	}
+
+	vk = crypt_alloc_volume_key(params->volume_key_size, params->volume_key);
+	vk_new = crypt_alloc_volume_key(params->new_volume_key_size,
+					params->new_volume_key);
+	cipher = _reencrypt_cipher(cd);
+	cipher_new = _reencrypt_cipher(params->cd_new);
+	if (!vk || !vk_new || !cipher || !cipher_new) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	_reencrypt_hotzone_name(name, hotzone, sizeof(hotzone));
+	snprintf(hotzone_path, sizeof(hotzone_path), "%s/%s", dm_get_dir(), hotzone);
+
+	hz_suspended = dm_status_suspended(hotzone);
+	if (hz_suspended < 0) {
+		/*
+		 * Without hotzone the device is mapped by one key only, so it can
+		 * be switched only at the start or at the end of reencryption.
+		 */
+		if (offset && offset < size) {
+			log_err(cd, _("Device %s is not in reencryption state.\n"), name);
+			r = -EINVAL;
+			goto out;
+		}
+
+		/* First switch, both keys must match their headers */
+		r = LUKS_verify_volume_key(&cd->hdr, vk);
+		if (!r)
+			r = LUKS_verify_volume_key(&params->cd_new->hdr, vk_new);
+		if (r < 0) {
+			log_err(cd, _("Volume key does not match the volume.\n"));
+			goto out;
+		}
+	} else {
+		/*
+		 * Hotzone from previous step. If it is already below offset,
+		 * its data were rewritten and it must use the new key before
+		 * any queued I/O is released.
+		 */
+		r = dm_query_device(hotzone, 0, &dmd_hz);
+		if (r < 0)
+			goto out;
+
+		/* Hotzone mapping the current top table relies on */
+		vk_hz = vk;
+		cd_hz = cd;
+		if (dmd_hz.iv_offset + dmd_hz.size <= offset) {
+			vk_hz = vk_new;
+			cd_hz = params->cd_new;
+			r = _reencrypt_hotzone_load(cd, cd_hz, hotzone, vk_hz,
+				dmd_hz.iv_offset, dmd_hz.size, dmd.flags, 1);
+		} else if (hz_suspended)
+			r = dm_resume_device(hotzone);
+		if (r < 0)
+			goto out;
+	}
+
+	/* Flush all I/O, nothing can reach hotzone until the top is resumed */
+	r = dm_suspend_device(name);
+	if (r < 0) {
+		log_err(cd, _("Cannot suspend device %s.\n"), name);
+		goto out;
+	}
+
+	if (length) {
+		r = _reencrypt_hotzone_load(cd, cd, hotzone, vk, offset, length,
+					    dmd.flags, hz_suspended >= 0);
+		if (r < 0) {
+			dm_resume_device(name);
+			goto out;
+		}
+	}
+
+	if (offset) {
+		segs[count].device = crypt_get_device_name(cd);
+		segs[count].cipher = cipher_new;
+		segs[count].vk = vk_new;
+		segs[count].offset = crypt_get_data_offset(cd);
+		segs[count].iv_offset = 0;
+		segs[count++].size = offset;
+	}
+
+	if (length) {
+		segs[count].device = hotzone_path;
+		segs[count].cipher = NULL;
+		segs[count].vk = NULL;
+		segs[count].offset = 0;
+		segs[count].iv_offset = 0;
+		segs[count++].size = length;
+	}
+
+	if (offset + length < size) {
+		segs[count].device = crypt_get_device_name(cd);
+		segs[count].cipher = cipher;
+		segs[count].vk = vk;
+		segs[count].offset = crypt_get_data_offset(cd) + offset + length;
+		segs[count].iv_offset = offset + length;
+		segs[count++].size = size - offset - length;
+	}
+
+	r = dm_reload_segments(name, segs, count, dmd.flags);
+	if (r < 0) {
+		log_err(cd, _("Cannot reload device %s.\n"), name);
+		/*
+		 * Old top table still routes the previous window through
+		 * hotzone, it must map these sectors again before resume.
+		 */
+		if (length && hz_suspended >= 0 &&
+		    _reencrypt_hotzone_load(cd, cd_hz, hotzone, vk_hz,
+				dmd_hz.iv_offset, dmd_hz.size, dmd.flags, 1) < 0) {
+			log_err(cd, _("Cannot restore reencryption hotzone of %s, "
+				"device stays suspended.\n"), name);
+			goto out;
+		}
+		dm_resume_device(name);
+		/* New hotzone is not referenced by the old table */
+		if (length && hz_suspended < 0)
+			dm_remove_device(cd, hotzone, 0, 0);
+		goto out;
+	}
+
+	/* Hotzone is no longer referenced */
+	if (!length && hz_suspended >= 0)
+		dm_remove_device(cd, hotzone, 0, 0);
+out:
+	free(cipher);
+	free(cipher_new);
+	free((char*)dmd.uuid);
+	crypt_free_volume_key(vk);
+	crypt_free_volume_key(vk_new);
+	return r;
+}
+
+int crypt_reencrypt_hotzone_suspend(struct crypt_device *cd, const char *name)
+{
+	char hotzone[128];
+	int r;
+
+	_reencrypt_hotzone_name(name, hotzone, sizeof(hotzone));
+	log_dbg("Suspending reencryption hotzone %s.", hotzone);
+
+	r = dm_status_suspended(hotzone);
+	if (r < 0) {
+		log_err(cd, _("Reencryption hotzone of %s is not active.\n"), name);
+		return r;
+	}
+
+	if (r)
+		return 0;
+
+	return dm_suspend_device(hotzone);
+}
+
 // slot manipulation
 int crypt_keyslot_add_by_passphrase(struct crypt_device *cd,
 	int keyslot, // -1 any
@@ -1183,6 +1741,10 @@ int crypt_keyslot_add_by_passphrase(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	r = keyslot_verify_or_find_empty(cd, &keyslot);
 	if (r)
 		return r;
@@ -1257,6 +1819,10 @@ int crypt_keyslot_add_by_keyfile(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	r = keyslot_verify_or_find_empty(cd, &keyslot);
 	if (r)
 		return r;
@@ -1326,6 +1892,10 @@ int crypt_keyslot_add_by_volume_key(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	if (volume_key)
 		vk = crypt_alloc_volume_key(volume_key_size, volume_key);
 	else if (cd->volume_key)
@@ -1414,6 +1984,10 @@ int crypt_activate_by_passphrase(struct crypt_device *cd,
 		}
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	/* plain, use hashed passphrase */
 	if (isPLAIN(cd->type)) {
 		if (!name)
@@ -1485,6 +2059,10 @@ int crypt_activate_by_keyfile(struct crypt_device *cd,
 		}
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	if (!keyfile)
 		return -EINVAL;
 
@@ -1525,6 +2103,9 @@ int crypt_activate_by_keyfile(struct crypt_device *cd,
 	} else if (isLOOPAES(cd->type)) {
 		r = key_from_file(cd, NULL, &passphrase_read, &passphrase_size_read,
 				  keyfile, keyfile_size);
+		if (r < 0)
+			goto out;
+		r = loopaes_gpg_keyfile(cd, &passphrase_read, &passphrase_size_read);
 		if (r < 0)
 			goto out;
 		r = LOOPAES_parse_keyfile(cd, &vk, cd->loopaes_hdr.hash, &key_count,
@@ -1566,6 +2147,10 @@ int crypt_activate_by_volume_key(struct crypt_device *cd,
 		}
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	/* use key directly, no hash */
 	if (isPLAIN(cd->type)) {
 		if (!name)
@@ -1625,7 +2210,7 @@ int crypt_deactivate(struct crypt_device *cd, const char *name)
 
 	switch (crypt_status(cd, name)) {
 		case CRYPT_ACTIVE:
-			r = dm_remove_device(name, 0, 0);
+			r = dm_remove_device(cd, name, 0, 0);
 			break;
 		case CRYPT_BUSY:
 			log_err(cd, _("Device %s is busy.\n"), name);
@@ -1641,7 +2226,7 @@ int crypt_deactivate(struct crypt_device *cd, const char *name)
 	}
 
 	if (!cd)
-		dm_exit();
+		dm_exit(NULL);
 
 	return r;
 }
@@ -1663,6 +2248,10 @@ int crypt_volume_key_get(struct crypt_device *cd,
 		return -ENOMEM;
 	}
 
+	r = crypt_attach_image_file(cd);
+	if (r < 0)
+		return r;
+
 	if (isPLAIN(cd->type) && cd->plain_hdr.hash) {
 		r = process_key(cd, cd->plain_hdr.hash, key_len,
 				passphrase, passphrase_size, &vk);
@@ -1768,7 +2357,7 @@ crypt_status_info crypt_status(struct crypt_device *cd, const char *name)
 	r = dm_status_device(name);
 
 	if (!cd)
-		dm_exit();
+		dm_exit(NULL);
 
 	if (r < 0 && r != -ENODEV)
 		return CRYPT_INVALID;
@@ -1839,6 +2428,72 @@ int crypt_dump(struct crypt_device *cd)
 	return 0;
 }
 
+static void _json_hex(struct crypt_device *cd, const char *d, int n)
+{
+	int i;
+
+	log_std(cd, "\"");
+	for(i = 0; i < n; i++)
+		log_std(cd, "%02hhx", (char)d[i]);
+	log_std(cd, "\"");
+}
+
+static void _json_string(struct crypt_device *cd, const char *s)
+{
+	char *js = crypt_json_string(s);
+
+	log_std(cd, "%s", js ?: "null");
+	free(js);
+}
+
+int crypt_dump_json(struct crypt_device *cd)
+{
+	struct luks_phdr *hdr = &cd->hdr;
+	int i;
+
+	if (!isLUKS(cd->type)) {
+		log_err(cd, _("This operation is supported only for LUKS device.\n"));
+		return -EINVAL;
+	}
+
+	log_std(cd, "{\n  \"device\": ");
+	_json_string(cd, mdata_device(cd));
+	log_std(cd, ",\n  \"version\": %d,\n", hdr->version);
+	log_std(cd, "  \"cipher_name\": ");
+	_json_string(cd, hdr->cipherName);
+	log_std(cd, ",\n  \"cipher_mode\": ");
+	_json_string(cd, hdr->cipherMode);
+	log_std(cd, ",\n  \"hash_spec\": ");
+	_json_string(cd, hdr->hashSpec);
+	log_std(cd, ",\n  \"payload_offset\": %d,\n", hdr->payloadOffset);
+	log_std(cd, "  \"mk_bits\": %d,\n", hdr->keyBytes * 8);
+	log_std(cd, "  \"mk_digest\": ");
+	_json_hex(cd, hdr->mkDigest, LUKS_DIGESTSIZE);
+	log_std(cd, ",\n  \"mk_salt\": ");
+	_json_hex(cd, hdr->mkDigestSalt, LUKS_SALTSIZE);
+	log_std(cd, ",\n  \"mk_iterations\": %d,\n", hdr->mkDigestIterations);
+	log_std(cd, "  \"uuid\": ");
+	_json_string(cd, hdr->uuid);
+	log_std(cd, ",\n  \"keyslots\": [\n");
+
+	for (i = 0; i < LUKS_NUMKEYS; i++) {
+		log_std(cd, "    { \"slot\": %d, \"enabled\": %s", i,
+			hdr->keyblock[i].active == LUKS_KEY_ENABLED ? "true" : "false");
+		if (hdr->keyblock[i].active == LUKS_KEY_ENABLED) {
+			log_std(cd, ", \"iterations\": %d, \"salt\": ",
+				hdr->keyblock[i].passwordIterations);
+			_json_hex(cd, hdr->keyblock[i].passwordSalt, LUKS_SALTSIZE);
+			log_std(cd, ", \"key_material_offset\": %d, \"stripes\": %d",
+				hdr->keyblock[i].keyMaterialOffset,
+				hdr->keyblock[i].stripes);
+		}
+		log_std(cd, " }%s\n", i < LUKS_NUMKEYS - 1 ? "," : "");
+	}
+	log_std(cd, "  ]\n}\n");
+
+	return 0;
+}
+
 const char *crypt_get_cipher(struct crypt_device *cd)
 {
 	if (isPLAIN(cd->type))
@@ -1970,3 +2625,74 @@ int crypt_get_active_device(struct crypt_device *cd __attribute__((unused)),
 
 	return 0;
 }
+
+int crypt_list_active(struct crypt_active_entry **list)
+{
+	int r;
+
+	if (!list)
+		return -EINVAL;
+
+	r = dm_init(NULL, 1);
+	if (r < 0)
+		return r;
+
+	r = dm_list_devices(list);
+	dm_exit(NULL);
+
+	if (r >= 0)
+		log_dbg("Found %d active crypt devices.", r);
+	return r;
+}
+
+void crypt_free_active_list(struct crypt_active_entry *list, int count)
+{
+	int i;
+
+	if (!list)
+		return;
+
+	for (i = 0; i < count; i++) {
+		free(list[i].name);
+		free(list[i].uuid);
+	}
+	free(list);
+}
+
+int crypt_get_kernel_flags(uint32_t *flags)
+{
+	uint32_t dmf;
+
+	if (!flags)
+		return -EINVAL;
+
+	if (dm_init(NULL, 0) < 0)
+		return -ENOSYS;
+
+	dmf = dm_flags();
+	if (!dm_flags_checked()) {
+		log_dbg("Kernel dm-crypt target is not available.");
+		dm_exit(NULL);
+		return -ENOTSUP;
+	}
+	dm_exit(NULL);
+
+	*flags = 0;
+	if (dmf & DM_KEY_WIPE_SUPPORTED)
+		*flags |= CRYPT_KERNEL_KEY_WIPE;
+	if (dmf & DM_LMK_SUPPORTED)
+		*flags |= CRYPT_KERNEL_LMK;
+	if (dmf & DM_SECURE_SUPPORTED)
+		*flags |= CRYPT_KERNEL_SECURE;
+	if (dmf & DM_PLAIN64_SUPPORTED)
+		*flags |= CRYPT_KERNEL_PLAIN64;
+	if (dmf & DM_DISCARDS_SUPPORTED)
+		*flags |= CRYPT_KERNEL_DISCARDS;
+
+	return 0;
+}
+
+void crypt_invalidate_kernel_flags(void)
+{
+	dm_flags_invalidate();
+}
@@ -128,11 +128,17 @@ int device_read_ahead(const char *dev, uint32_t *read_ahead)
 
 static int sector_size(int fd) 
 {
+	struct stat st;
 	int bsize;
-	if (ioctl(fd,BLKSSZGET, &bsize) < 0)
-		return -EINVAL;
-	else
+
+	if (ioctl(fd,BLKSSZGET, &bsize) >= 0)
 		return bsize;
+
+	/* Image file, page size is multiple of any logical block size */
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+		return (int)sysconf(_SC_PAGESIZE);
+
+	return -EINVAL;
 }
 
 int sector_size_for_device(const char *device)
@@ -336,16 +342,44 @@ int device_ready(struct crypt_device *cd, const char *device, int mode)
 	return r;
 }
 
+/*
+ * Image file can be used directly only if its filesystem supports O_DIRECT
+ * (header I/O uses it), otherwise (e.g. tmpfs) loop device must be attached.
+ */
+int device_is_image_file(const char *device)
+{
+	struct stat st;
+	int fd;
+
+	if (stat(device, &st) < 0 || !S_ISREG(st.st_mode))
+		return 0;
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		if (errno == EINVAL)
+			log_dbg("Image file %s does not support direct I/O.", device);
+		return 0;
+	}
+
+	close(fd);
+	return 1;
+}
+
 int device_size(const char *device, uint64_t *size)
 {
+	struct stat st;
 	int devfd, r = 0;
 
 	devfd = open(device, O_RDONLY);
 	if(devfd == -1)
 		return -EINVAL;
 
-	if (ioctl(devfd, BLKGETSIZE64, size) < 0)
-		r = -EINVAL;
+	if (ioctl(devfd, BLKGETSIZE64, size) < 0) {
+		if (!fstat(devfd, &st) && S_ISREG(st.st_mode))
+			*size = st.st_size;
+		else
+			r = -EINVAL;
+	}
 
 	close(devfd);
 	return r;
@@ -0,0 +1,241 @@
+/*
+ * libcryptsetup - cryptsetup library, cipher benchmark
+ *
+ * Copyright (C) 2012, Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "libcryptsetup.h"
+#include "internal.h"
+#include "crypto_backend.h"
+#include "pbkdf.h"
+
+/*
+ * This is not simulating storage, so using disk block causes extreme overhead.
+ * Let's use some fixed block size where results are more reliable...
+ */
+#define CIPHER_BLOCK_BYTES 65536
+
+/* Minimal time of one measurement */
+#define CIPHER_BENCH_MS 1000
+
+/*
+ * The whole test depends on Linux kernel usermode crypto API for now.
+ * (The same implementations are used in dm-crypt though.)
+ */
+
+struct cipher_perf {
+	char name[32];
+	char mode[32];
+	char *key;
+	size_t key_length;
+	char *iv;
+	size_t iv_length;
+	size_t buffer_size;
+};
+
+static long time_ms(struct timeval *start, struct timeval *end)
+{
+	long ms;
+
+	ms = (end->tv_sec - start->tv_sec) * 1000;
+	ms += (end->tv_usec - start->tv_usec) / 1000;
+
+	return ms;
+}
+
+static int cipher_perf_one(struct cipher_perf *cp, char *buf,
+			   size_t buf_size, int enc)
+{
+	struct crypt_cipher *cipher = NULL;
+	size_t done = 0, block = CIPHER_BLOCK_BYTES;
+	int r;
+
+	if (buf_size < block)
+		block = buf_size;
+
+	r = crypt_cipher_init(&cipher, cp->name, cp->mode, cp->key, cp->key_length);
+	if (r < 0) {
+		log_dbg("Cannot initialise cipher %s, mode %s.", cp->name, cp->mode);
+		return r;
+	}
+
+	while (done < buf_size) {
+		if ((done + block) > buf_size)
+			block = buf_size - done;
+
+		if (enc)
+			r = crypt_cipher_encrypt(cipher, &buf[done], &buf[done],
+						 block, cp->iv, cp->iv_length);
+		else
+			r = crypt_cipher_decrypt(cipher, &buf[done], &buf[done],
+						 block, cp->iv, cp->iv_length);
+		if (r < 0)
+			break;
+
+		done += block;
+	}
+
+	crypt_cipher_destroy(cipher);
+
+	return r;
+}
+
+/* Repeat the whole buffer for at least CIPHER_BENCH_MS, returns MiB/s */
+static int cipher_measure(struct cipher_perf *cp, char *buf, int enc,
+			  double *mbs)
+{
+	struct timeval start, end;
+	unsigned long repeat = 0;
+	long ms;
+	int r;
+
+	if (gettimeofday(&start, NULL) < 0)
+		return -EINVAL;
+
+	do {
+		r = cipher_perf_one(cp, buf, cp->buffer_size, enc);
+		if (r < 0)
+			return r;
+		repeat++;
+
+		if (gettimeofday(&end, NULL) < 0)
+			return -EINVAL;
+		ms = time_ms(&start, &end);
+	} while (ms < CIPHER_BENCH_MS);
+
+	*mbs = (double)cp->buffer_size * repeat / (1024 * 1024) / (ms / 1000.);
+	return 0;
+}
+
+static int cipher_perf(struct cipher_perf *cp,
+	double *encryption_mbs, double *decryption_mbs)
+{
+	void *buf = NULL;
+	int r;
+
+	if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), cp->buffer_size))
+		return -ENOMEM;
+
+	memset(buf, 0, cp->buffer_size);
+
+	r = cipher_measure(cp, buf, 1, encryption_mbs);
+	if (!r)
+		r = cipher_measure(cp, buf, 0, decryption_mbs);
+
+	free(buf);
+	return r;
+}
+
+int crypt_benchmark(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	size_t buffer_size,
+	double *encryption_mbs,
+	double *decryption_mbs)
+{
+	struct cipher_perf cp = {
+		.key_length = volume_key_size,
+		.buffer_size = buffer_size,
+	};
+	char *c;
+	int r;
+
+	if (!cipher || !cipher_mode || !volume_key_size ||
+	    !encryption_mbs || !decryption_mbs)
+		return -EINVAL;
+
+	if (!buffer_size || buffer_size % SECTOR_SIZE)
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	strncpy(cp.name, cipher, sizeof(cp.name)-1);
+	strncpy(cp.mode, cipher_mode, sizeof(cp.mode)-1);
+
+	/* Ignore IV generator */
+	if ((c  = strchr(cp.mode, '-')))
+		*c = '\0';
+
+	/* IV is one cipher block, ECB mode uses none */
+	if (strcmp(cp.mode, "ecb")) {
+		r = crypt_cipher_blocksize(cp.name);
+		if (r < 0)
+			return r == -EINVAL ? -ENOENT : r;
+		cp.iv_length = r;
+	}
+
+	r = -ENOMEM;
+	if (cp.iv_length) {
+		cp.iv = malloc(cp.iv_length);
+		if (!cp.iv)
+			goto out;
+		r = crypt_random_get(cd, cp.iv, cp.iv_length, CRYPT_RND_NORMAL);
+		if (r < 0)
+			goto out;
+	}
+
+	r = -ENOMEM;
+	cp.key = malloc(volume_key_size);
+	if (!cp.key)
+		goto out;
+
+	r = crypt_random_get(cd, cp.key, volume_key_size, CRYPT_RND_NORMAL);
+	if (r < 0)
+		goto out;
+
+	log_dbg("Running %s-%s benchmark, key %zu bytes, buffer %zu bytes.",
+		cp.name, cp.mode, volume_key_size, buffer_size);
+
+	r = cipher_perf(&cp, encryption_mbs, decryption_mbs);
+out:
+	free(cp.key);
+	free(cp.iv);
+	return r;
+}
+
+int crypt_benchmark_kdf(struct crypt_device *cd,
+	const char *kdf,
+	const char *hash,
+	uint64_t *iterations_sec)
+{
+	int r;
+
+	if (!kdf || !hash || !iterations_sec)
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	if (strcmp(kdf, "pbkdf2"))
+		return -EINVAL;
+
+	r = PBKDF2_performance_check(hash, iterations_sec);
+	if (!r)
+		log_dbg("KDF %s, hash %s: %" PRIu64 " iterations per second.",
+			kdf, hash, *iterations_sec);
+
+	return r;
+}
@@ -20,14 +20,17 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <pthread.h>
 
 #include "libcryptsetup.h"
 #include "nls.h"
@@ -36,11 +39,32 @@
 #define log_dbg(x) crypt_log(NULL, CRYPT_LOG_DEBUG, x)
 #define log_err(cd, x) crypt_log(cd, CRYPT_LOG_ERROR, x)
 
-struct safe_allocation {
-	size_t	size;
-	char	data[0];
+/*
+ * Secure arena for sensitive data (keys, passphrases).
+ * Memory is mapped separately from heap, locking (mlock) and exclusion
+ * from core dumps (MADV_DONTDUMP) are best effort only, failure is ignored.
+ * Memory is wiped when released.
+ * Small allocations are served from per size class slabs,
+ * large ones get dedicated mapping. Every mapping is surrounded
+ * by inaccessible guard pages. Metadata are kept out of the arena.
+ */
+#define SAFE_CLASS_MIN		32
+#define SAFE_CLASS_MAX		4096
+#define SAFE_SLAB_SIZE		(64 * 1024)
+
+struct safe_region {
+	struct safe_region *next;
+	char *base;		/* usable area, between guard pages */
+	size_t size;		/* usable size */
+	size_t chunk_size;	/* 0 for dedicated mapping */
+	unsigned chunks;
+	unsigned used;
+	uint32_t *bitmap;	/* allocated chunks */
 };
 
+static struct safe_region *safe_regions = NULL;
+static pthread_mutex_t safe_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int crypt_parse_name_and_mode(const char *s, char *cipher, int *key_nums,
 			      char *cipher_mode)
 {
@@ -68,53 +92,238 @@ int crypt_parse_name_and_mode(const char *s, char *cipher, int *key_nums,
 	return -EINVAL;
 }
 
+/*
+ * Quoted and escaped JSON string, shared by library and cryptsetup output.
+ * Returns allocated string, NULL input is printed as empty string.
+ */
+char *crypt_json_string(const char *s)
+{
+	const char *c;
+	char *out, *p;
+	size_t len = 3;
+
+	for (c = s; c && *c; c++)
+		len += (*c == '"' || *c == '\\') ? 2 :
+		       ((unsigned char)*c < 0x20) ? 6 : 1;
+
+	out = malloc(len);
+	if (!out)
+		return NULL;
+
+	p = out;
+	*p++ = '"';
+	for (c = s; c && *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			*p++ = '\\';
+			*p++ = *c;
+		} else if ((unsigned char)*c < 0x20)
+			p += sprintf(p, "\\u%04x", (unsigned char)*c);
+		else
+			*p++ = *c;
+	}
+	*p++ = '"';
+	*p = '\0';
+
+	return out;
+}
+
 /* safe allocations */
-void *crypt_safe_alloc(size_t size)
+static size_t safe_page_size(void)
 {
-	struct safe_allocation *alloc;
+	static size_t page_size = 0;
 
-	if (!size)
+	if (!page_size)
+		page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+	return page_size;
+}
+
+static struct safe_region *safe_region_new(size_t size, size_t chunk_size)
+{
+	struct safe_region *sr;
+	size_t page_size = safe_page_size();
+	char *map;
+
+	size = (size + page_size - 1) & ~(page_size - 1);
+
+	sr = calloc(1, sizeof(*sr));
+	if (!sr)
+		return NULL;
+
+	if (chunk_size) {
+		sr->chunks = size / chunk_size;
+		sr->bitmap = calloc((sr->chunks + 31) / 32, sizeof(uint32_t));
+		if (!sr->bitmap) {
+			free(sr);
+			return NULL;
+		}
+	} else
+		sr->chunks = 1;
+
+	map = mmap(NULL, size + 2 * page_size, PROT_NONE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		free(sr->bitmap);
+		free(sr);
+		return NULL;
+	}
+
+	sr->base = map + page_size;
+	sr->size = size;
+	sr->chunk_size = chunk_size;
+
+	if (mprotect(sr->base, size, PROT_READ | PROT_WRITE) < 0) {
+		munmap(map, size + 2 * page_size);
+		free(sr->bitmap);
+		free(sr);
+		return NULL;
+	}
+
+	/* Best effort only, locking can be limited by RLIMIT_MEMLOCK */
+	(void)mlock(sr->base, size);
+#ifdef MADV_DONTDUMP
+	(void)madvise(sr->base, size, MADV_DONTDUMP);
+#endif
+
+	sr->next = safe_regions;
+	safe_regions = sr;
+
+	return sr;
+}
+
+static void safe_region_destroy(struct safe_region *sr)
+{
+	struct safe_region **srp;
+	size_t page_size = safe_page_size();
+
+	for (srp = &safe_regions; *srp; srp = &(*srp)->next)
+		if (*srp == sr) {
+			*srp = sr->next;
+			break;
+		}
+
+	memset(sr->base, 0, sr->size);
+	munlock(sr->base, sr->size);
+	munmap(sr->base - page_size, sr->size + 2 * page_size);
+	free(sr->bitmap);
+	free(sr);
+}
+
+static struct safe_region *safe_region_find(const void *data)
+{
+	struct safe_region *sr;
+
+	for (sr = safe_regions; sr; sr = sr->next)
+		if ((const char *)data >= sr->base &&
+		    (const char *)data < sr->base + sr->size)
+			return sr;
+
+	return NULL;
+}
+
+/* Usable size of allocated block */
+static size_t safe_size(const void *data)
+{
+	struct safe_region *sr;
+	size_t size = 0;
+
+	pthread_mutex_lock(&safe_regions_lock);
+	sr = safe_region_find(data);
+	if (sr)
+		size = sr->chunk_size ?: sr->size;
+	pthread_mutex_unlock(&safe_regions_lock);
+
+	return size;
+}
+
+/* Regions list is shared by all threads, called with the lock held */
+static void *safe_alloc_locked(size_t size)
+{
+	struct safe_region *sr;
+	size_t chunk_size;
+	unsigned i;
+
+	if (size > SAFE_CLASS_MAX) {
+		sr = safe_region_new(size, 0);
+		if (!sr)
+			return NULL;
+		sr->used = 1;
+		return sr->base;
+	}
+
+	for (chunk_size = SAFE_CLASS_MIN; chunk_size < size; chunk_size <<= 1)
+		;
+
+	for (sr = safe_regions; sr; sr = sr->next)
+		if (sr->chunk_size == chunk_size && sr->used < sr->chunks)
+			break;
+
+	if (!sr && !(sr = safe_region_new(SAFE_SLAB_SIZE, chunk_size)))
 		return NULL;
 
-	alloc = malloc(size + offsetof(struct safe_allocation, data));
-	if (!alloc)
+	for (i = 0; i < sr->chunks; i++)
+		if (!(sr->bitmap[i / 32] & (1U << (i % 32)))) {
+			sr->bitmap[i / 32] |= 1U << (i % 32);
+			sr->used++;
+			return sr->base + i * chunk_size;
+		}
+
+	return NULL;
+}
+
+void *crypt_safe_alloc(size_t size)
+{
+	void *data;
+
+	if (!size)
 		return NULL;
 
-	alloc->size = size;
+	pthread_mutex_lock(&safe_regions_lock);
+	data = safe_alloc_locked(size);
+	pthread_mutex_unlock(&safe_regions_lock);
 
-	return &alloc->data;
+	return data;
 }
 
 void crypt_safe_free(void *data)
 {
-	struct safe_allocation *alloc;
+	struct safe_region *sr;
+	unsigned i;
 
 	if (!data)
 		return;
 
-	alloc = (struct safe_allocation *)
-		((char *)data - offsetof(struct safe_allocation, data));
-
-	memset(data, 0, alloc->size);
+	pthread_mutex_lock(&safe_regions_lock);
+	sr = safe_region_find(data);
+	if (!sr) {
+		pthread_mutex_unlock(&safe_regions_lock);
+		/* Memory not from crypt_safe_alloc() is never released here */
+		log_err(NULL, _("Internal error: releasing unknown secure memory.\n"));
+		return;
+	}
 
-	alloc->size = 0x55aa55aa;
-	free(alloc);
+	if (!sr->chunk_size)
+		safe_region_destroy(sr);
+	else {
+		i = ((char *)data - sr->base) / sr->chunk_size;
+		memset(sr->base + i * sr->chunk_size, 0, sr->chunk_size);
+		sr->bitmap[i / 32] &= ~(1U << (i % 32));
+		sr->used--;
+	}
+	pthread_mutex_unlock(&safe_regions_lock);
 }
 
 void *crypt_safe_realloc(void *data, size_t size)
 {
-	struct safe_allocation *alloc;
 	void *new_data;
+	size_t old_size;
 
 	new_data = crypt_safe_alloc(size);
 
 	if (new_data && data) {
-
-		alloc = (struct safe_allocation *)
-			((char *)data - offsetof(struct safe_allocation, data));
-
-		if (size > alloc->size)
-			size = alloc->size;
+		old_size = safe_size(data);
+		if (size > old_size)
+			size = old_size;
 
 		memcpy(new_data, data, size);
 	}
@@ -260,10 +469,11 @@ int crypt_get_key(const char *prompt,
 		  int timeout, int verify,
 		  struct crypt_device *cd)
 {
-	int fd, regular_file, read_stdin, char_read, unlimited_read = 0;
+	int fd, regular_file, read_stdin, unlimited_read = 0;
 	int r = -EINVAL;
 	char *pass = NULL;
-	size_t buflen, i;
+	size_t buflen, read_size, i;
+	ssize_t char_read;
 	struct stat st;
 
 	*key = NULL;
@@ -292,21 +502,26 @@ int crypt_get_key(const char *prompt,
 		return -EINVAL;
 	}
 
-	/* use 4k for buffer (page divisor but avoid huge pages) */
-	buflen = 4096 - sizeof(struct safe_allocation);
+	/* use largest arena size class for buffer */
+	buflen = SAFE_CLASS_MAX;
 	regular_file = 0;
 	if(!read_stdin) {
-		if(stat(key_file, &st) < 0) {
+		if(fstat(fd, &st) < 0) {
 			log_err(cd, _("Failed to stat key file.\n"));
 			goto out_err;
 		}
 		if(S_ISREG(st.st_mode)) {
 			regular_file = 1;
-			/* known keyfile size, alloc it in one step */
+			/*
+			 * known keyfile size, alloc it in one step
+			 * (with one spare byte so EOF is detected without realloc)
+			 */
 			if ((size_t)st.st_size >= keyfile_size_max)
 				buflen = keyfile_size_max;
+			else if (st.st_size)
+				buflen = st.st_size + 1;
 			else
-				buflen = st.st_size;
+				buflen = 0;
 		}
 	}
 
@@ -316,9 +531,11 @@ int crypt_get_key(const char *prompt,
 		goto out_err;
 	}
 
-	for(i = 0; i < keyfile_size_max; i++) {
+	for(i = 0; i < keyfile_size_max; i += char_read) {
 		if(i == buflen) {
-			buflen += 4096;
+			/* Grow geometrically, realloc copies the whole buffer */
+			buflen = buflen > keyfile_size_max / 2 ?
+				 keyfile_size_max : buflen * 2;
 			pass = crypt_safe_realloc(pass, buflen);
 			if (!pass) {
 				log_err(cd, _("Out of memory while reading passphrase.\n"));
@@ -327,13 +544,21 @@ int crypt_get_key(const char *prompt,
 			}
 		}
 
-		char_read = read(fd, &pass[i], 1);
+		/*
+		 * Stop on newline only if not requested read from keyfile.
+		 * In that case read byte by byte to not consume data after
+		 * newline, otherwise fill the buffer in as few reads as possible.
+		 */
+		read_size = key_file ? buflen - i : 1;
+		if (read_size > keyfile_size_max - i)
+			read_size = keyfile_size_max - i;
+
+		char_read = read(fd, &pass[i], read_size);
 		if (char_read < 0) {
 			log_err(cd, _("Error reading passphrase.\n"));
 			goto out_err;
 		}
 
-		/* Stop on newline only if not requested read from keyfile */
 		if(char_read == 0 || (!key_file && pass[i] == '\n'))
 			break;
 	}
@@ -19,6 +19,8 @@ int crypt_get_key(const char *prompt,
 		  int timeout, int verify,
 		  struct crypt_device *cd);
 
+char *crypt_json_string(const char *s);
+
 void *crypt_safe_alloc(size_t size);
 void crypt_safe_free(void *data);
 void *crypt_safe_realloc(void *data, size_t size);
@@ -14,12 +14,15 @@ struct volume_key;
 #define DM_PLAIN64_SUPPORTED  (1 << 3)	/* plain64 IV */
 #define DM_DISCARDS_SUPPORTED (1 << 4)	/* discards/TRIM option is supported */
 uint32_t dm_flags(void);
+int dm_flags_checked(void);
+void dm_flags_invalidate(void);
 
 #define DM_ACTIVE_DEVICE	(1 << 0)
 #define DM_ACTIVE_CIPHER	(1 << 1)
 #define DM_ACTIVE_UUID		(1 << 2)
 #define DM_ACTIVE_KEYSIZE	(1 << 3)
 #define DM_ACTIVE_KEY		(1 << 4)
+#define DM_ACTIVE_SEGMENTS	(1 << 5)	/* accept reencryption table */
 
 struct crypt_dm_active_device {
 	const char *device;
@@ -36,10 +39,22 @@ struct crypt_dm_active_device {
 	uint32_t flags;		/* activation flags */
 };
 
+/* Table segment, segment without cipher is linear mapping */
+struct crypt_dm_segment {
+	const char *device;
+	const char *cipher;
+	struct volume_key *vk;
+	uint64_t offset;	/* offset in sectors */
+	uint64_t iv_offset;	/* IV initilisation sector */
+	uint64_t size;		/* segment size */
+};
+
 const char *dm_get_dir(void);
 int dm_init(struct crypt_device *context, int check_kernel);
-void dm_exit(void);
-int dm_remove_device(const char *name, int force, uint64_t size);
+void dm_exit(struct crypt_device *context);
+int dm_remove_device(struct crypt_device *cd, const char *name, int force, uint64_t size);
+int dm_remove_temp_device(struct crypt_device *cd, const char *name, uint64_t size);
+void dm_remove_stale_temp_devices(const char *prefix);
 int dm_status_device(const char *name);
 int dm_status_suspended(const char *name);
 int dm_query_device(const char *name, uint32_t get_flags,
@@ -48,6 +63,12 @@ int dm_create_device(const char *name,
 		      const char *type,
 		      struct crypt_dm_active_device *dmd,
 		      int reload);
+int dm_reload_segments(const char *name,
+		       struct crypt_dm_segment *segs,
+		       int count,
+		       uint32_t flags);
+int dm_suspend_device(const char *name);
+int dm_resume_device(const char *name);
 int dm_suspend_and_wipe_key(const char *name);
 int dm_resume_and_reinstate_key(const char *name,
 				size_t key_size,
@@ -57,4 +78,7 @@ int dm_is_dm_device(int major, int minor);
 int dm_is_dm_kernel_name(const char *name);
 int dm_check_segment(const char *name, uint64_t offset, uint64_t size);
 
+struct crypt_active_entry;
+int dm_list_devices(struct crypt_active_entry **list);
+
 #endif /* _UTILS_DM_H */
@@ -23,21 +23,74 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <linux/loop.h>
 
 #include "utils_loop.h"
 
+#ifndef LO_FLAGS_DIRECT_IO
+#define LO_FLAGS_DIRECT_IO 16
+#endif
+
+#ifndef LOOP_CTL_GET_FREE
+#define LOOP_CTL_GET_FREE 0x4C82
+#endif
+
+#ifndef LOOP_SET_DIRECT_IO
+#define LOOP_SET_DIRECT_IO 0x4C08
+#endif
+
+#ifndef LOOP_CONFIGURE
+#define LOOP_CONFIGURE 0x4C0A
+struct loop_config {
+	uint32_t fd;
+	uint32_t block_size;
+	struct loop_info64 info;
+	uint64_t __reserved[8];
+};
+#endif
+
+#define LOOP_CONTROL "/dev/loop-control"
+
+/* Ask kernel for free loop device (and create it if needed) */
+static char *_loop_control_get_free(void)
+{
+	char dev[64];
+	int ctl_fd, i;
+	struct stat st;
+
+	ctl_fd = open(LOOP_CONTROL, O_RDWR);
+	if (ctl_fd < 0)
+		return NULL;
+
+	i = ioctl(ctl_fd, LOOP_CTL_GET_FREE);
+	close(ctl_fd);
+	if (i < 0)
+		return NULL;
+
+	snprintf(dev, sizeof(dev), "/dev/loop%d", i);
+	if (stat(dev, &st) || !S_ISBLK(st.st_mode))
+		return NULL;
+
+	return strdup(dev);
+}
+
 char *crypt_loop_get_device(void)
 {
-	char dev[20];
+	char dev[64], *loop;
 	int i, loop_fd;
 	struct stat st;
 	struct loop_info64 lo64 = {0};
 
-	for (i = 0; i < 256; i++) {
-		sprintf(dev, "/dev/loop%d", i);
+	loop = _loop_control_get_free();
+	if (loop)
+		return loop;
+
+	/* Old kernel without loop-control, scan existing devices */
+	for (i = 0; ; i++) {
+		snprintf(dev, sizeof(dev), "/dev/loop%d", i);
 		if (stat(dev, &st) || !S_ISBLK(st.st_mode))
 			return NULL;
 
@@ -56,11 +109,48 @@ char *crypt_loop_get_device(void)
 	return NULL;
 }
 
+/*
+ * Configure loop device in one step (kernel 5.8+), otherwise fallback
+ * to LOOP_SET_FD and LOOP_SET_STATUS64. Direct IO avoids double caching
+ * of backing file pages, kernel silently ignores it if not possible.
+ */
+static int _loop_configure(int loop_fd, int file_fd, struct loop_info64 *lo64)
+{
+	struct loop_config config;
+	int r;
+
+	memset(&config, 0, sizeof(config));
+	config.fd = file_fd;
+	config.info = *lo64;
+	config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+
+	r = ioctl(loop_fd, LOOP_CONFIGURE, &config);
+	if (!r || (errno != EINVAL && errno != ENOTTY))
+		return r;
+
+	if (ioctl(loop_fd, LOOP_SET_FD, file_fd) < 0)
+		return -1;
+
+	if (ioctl(loop_fd, LOOP_SET_STATUS64, lo64) < 0) {
+		r = errno;
+		(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
+		errno = r;
+		return -1;
+	}
+
+	(void)ioctl(loop_fd, LOOP_SET_DIRECT_IO, 1UL);
+	return 0;
+}
+
+/*
+ * Returns open loop fd or -1. On failure errno is preserved, EBUSY means
+ * that the device was taken by someone else (get another one and retry).
+ */
 int crypt_loop_attach(const char *loop, const char *file, int offset,
 		      int autoclear, int *readonly)
 {
 	struct loop_info64 lo64 = {0};
-	int loop_fd = -1, file_fd = -1, r = 1;
+	int loop_fd = -1, file_fd = -1, r = 1, err = 0;
 
 	file_fd = open(file, (*readonly ? O_RDONLY : O_RDWR) | O_EXCL);
 	if (file_fd < 0 && errno == EROFS && !*readonly) {
@@ -79,30 +169,30 @@ int crypt_loop_attach(const char *loop, const char *file, int offset,
 	if (autoclear)
 		lo64.lo_flags |= LO_FLAGS_AUTOCLEAR;
 
-	if (ioctl(loop_fd, LOOP_SET_FD, file_fd) < 0)
+	if (_loop_configure(loop_fd, file_fd, &lo64) < 0)
 		goto out;
 
-	if (ioctl(loop_fd, LOOP_SET_STATUS64, &lo64) < 0) {
-		(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
-		goto out;
-	}
-
 	/* Verify that autoclear is really set */
 	if (autoclear) {
 		memset(&lo64, 0, sizeof(lo64));
 		if (ioctl(loop_fd, LOOP_GET_STATUS64, &lo64) < 0 ||
 		   !(lo64.lo_flags & LO_FLAGS_AUTOCLEAR)) {
 		(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
+			errno = EINVAL;
 			goto out;
 		}
 	}
 
 	r = 0;
 out:
+	if (r)
+		err = errno;
 	if (r && loop_fd >= 0)
 		close(loop_fd);
 	if (file_fd >= 0)
 		close(file_fd);
+	if (r)
+		errno = err;
 	return r ? -1 : loop_fd;
 }
 
@@ -0,0 +1,61 @@
+#ifndef _UTILS_PROBE_H
+#define _UTILS_PROBE_H
+
+/*
+ * Static tracepoints (USDT), provider "libcryptsetup".
+ *
+ * Compiled in only with --enable-sdt, a probe which is not attached
+ * is a single nop instruction. Arguments are not evaluated otherwise.
+ *
+ * Probes and arguments:
+ *   pbkdf2__start(device, keyslot, iterations)
+ *   pbkdf2__done(device, keyslot, iterations, r)
+ *   keyslot__try(device, keyslot)
+ *   keyslot__done(device, keyslot, r)
+ *   header__read(device), header__write(device)
+ *   dm__create(name, type), dm__create__done(name, r)
+ *   dm__remove(name), dm__remove__done(name, r)
+ *   dm__remove__busy(name, attempt, waited_ms)
+ *   udev__wait__start(cookie), udev__wait__done(cookie, r)
+ *   wipe__pass(device, from_sector, to_sector, pass)
+ *   phase(phase, keyslot, usec, bytes_read, bytes_written)
+ *     - fired for every phase reported by crypt_set_timing_callback()
+ *
+ * Every probe has a semaphore, crypt_probe_enabled() is nonzero only
+ * while a tracer is attached to the probe.
+ */
+
+#ifdef USE_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define CRYPT_PROBES(probe) \
+	probe(pbkdf2__start) probe(pbkdf2__done) \
+	probe(keyslot__try) probe(keyslot__done) \
+	probe(header__read) probe(header__write) \
+	probe(dm__create) probe(dm__create__done) \
+	probe(dm__remove) probe(dm__remove__done) probe(dm__remove__busy) \
+	probe(udev__wait__start) probe(udev__wait__done) \
+	probe(wipe__pass) probe(phase)
+
+#define CRYPT_PROBE_SEMAPHORE(n)	libcryptsetup_##n##_semaphore
+#define CRYPT_PROBE_DECLARE(n)	extern unsigned short CRYPT_PROBE_SEMAPHORE(n);
+CRYPT_PROBES(CRYPT_PROBE_DECLARE)
+
+#define crypt_probe_enabled(n)	__builtin_expect(CRYPT_PROBE_SEMAPHORE(n) != 0, 0)
+
+#define crypt_probe1(n, a)		DTRACE_PROBE1(libcryptsetup, n, a)
+#define crypt_probe2(n, a, b)		DTRACE_PROBE2(libcryptsetup, n, a, b)
+#define crypt_probe3(n, a, b, c)	DTRACE_PROBE3(libcryptsetup, n, a, b, c)
+#define crypt_probe4(n, a, b, c, d)	DTRACE_PROBE4(libcryptsetup, n, a, b, c, d)
+#define crypt_probe5(n, a, b, c, d, e)	DTRACE_PROBE5(libcryptsetup, n, a, b, c, d, e)
+#else
+#define crypt_probe_enabled(n)		0
+#define crypt_probe1(n, a)		do {} while (0)
+#define crypt_probe2(n, a, b)		do {} while (0)
+#define crypt_probe3(n, a, b, c)	do {} while (0)
+#define crypt_probe4(n, a, b, c, d)	do {} while (0)
+#define crypt_probe5(n, a, b, c, d, e)	do {} while (0)
+#endif
+
+#endif /* _UTILS_PROBE_H */
@@ -25,7 +25,7 @@
 
 struct volume_key *crypt_alloc_volume_key(unsigned keylength, const char *key)
 {
-	struct volume_key *vk = malloc(sizeof(*vk) + keylength);
+	struct volume_key *vk = crypt_safe_alloc(sizeof(*vk) + keylength);
 
 	if (!vk)
 		return NULL;
@@ -41,11 +41,7 @@ struct volume_key *crypt_alloc_volume_key(unsigned keylength, const char *key)
 
 void crypt_free_volume_key(struct volume_key *vk)
 {
-	if (vk) {
-		memset(vk->key, 0, vk->keylength);
-		vk->keylength = 0;
-		free(vk);
-	}
+	crypt_safe_free(vk);
 }
 
 struct volume_key *crypt_generate_volume_key(struct crypt_device *cd, unsigned keylength)
@@ -29,6 +29,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <libcryptsetup.h>
 #include <popt.h>
 
@@ -64,6 +66,8 @@ static int opt_urandom = 0;
 static int opt_dump_master_key = 0;
 static int opt_shared = 0;
 static int opt_allow_discards = 0;
+static int opt_all = 0;
+static int opt_json = 0;
 
 static const char **action_argv;
 static int action_argc;
@@ -86,6 +90,7 @@ static int action_luksResume(int arg);
 static int action_luksBackup(int arg);
 static int action_luksRestore(int arg);
 static int action_loopaesOpen(int arg);
+static int action_benchmark(int arg);
 
 static struct action_type {
 	const char *type;
@@ -112,10 +117,11 @@ static struct action_type {
 	{ "luksDump",	action_luksDump,	0, 1, 1, N_("<device>"), N_("dump LUKS partition information") },
 	{ "luksSuspend",action_luksSuspend,	0, 1, 1, N_("<device>"), N_("Suspend LUKS device and wipe key (all IOs are frozen).") },
 	{ "luksResume",	action_luksResume,	0, 1, 1, N_("<device>"), N_("Resume suspended LUKS device.") },
-	{ "luksHeaderBackup",action_luksBackup,	0, 1, 1, N_("<device>"), N_("Backup LUKS device header and keyslots") },
+	{ "luksHeaderBackup",action_luksBackup,	0, 1, 1, N_("<device> [<device>...]"), N_("Backup LUKS device header and keyslots") },
 	{ "luksHeaderRestore",action_luksRestore,0,1, 1, N_("<device>"), N_("Restore LUKS device header and keyslots") },
 	{ "loopaesOpen",action_loopaesOpen,	0, 2, 1, N_("<device> <name> "), N_("open loop-AES device as mapping <name>") },
 	{ "loopaesClose",action_remove,		0, 1, 1, N_("<name>"), N_("remove loop-AES mapping") },
+	{ "benchmark",	action_benchmark,	0, 0, 0, N_("<none>"), N_("benchmark cipher") },
 	{ NULL, NULL, 0, 0, 0, NULL, NULL }
 };
 
@@ -190,6 +196,20 @@ static void _log(int level, const char *msg, void *usrptr __attribute__((unused)
 	}
 }
 
+/* Per-phase breakdown of library operation, printed with --debug */
+static void _timing(const struct crypt_timing *t,
+		    void *usrptr __attribute__((unused)))
+{
+	char slot[8] = "-";
+
+	if (t->keyslot >= 0)
+		snprintf(slot, sizeof(slot), "%d", t->keyslot);
+
+	printf("# Timing: %-16s keyslot %-2s %10" PRIu64 " us, read %" PRIu64
+	       " bytes, written %" PRIu64 " bytes\n", t->phase, slot, t->usec,
+	       t->bytes_read, t->bytes_written);
+}
+
 static void show_status(int errcode)
 {
 	char error[256], *error_;
@@ -365,7 +385,15 @@ static int action_resize(int arg __attribute__((unused)))
 	return r;
 }
 
-static int action_status(int arg __attribute__((unused)))
+static void json_string(const char *s)
+{
+	char *js = crypt_json_string(s);
+
+	log_std("%s", js ?: "null");
+	free(js);
+}
+
+static int status_text(const char *name)
 {
 	crypt_status_info ci;
 	struct crypt_active_device cad;
@@ -374,26 +402,26 @@ static int action_status(int arg __attribute__((unused)))
 	const char *device;
 	int r = 0;
 
-	ci = crypt_status(NULL, action_argv[0]);
+	ci = crypt_status(NULL, name);
 	switch (ci) {
 	case CRYPT_INVALID:
 		r = -EINVAL;
 		break;
 	case CRYPT_INACTIVE:
-		log_std("%s/%s is inactive.\n", crypt_get_dir(), action_argv[0]);
+		log_std("%s/%s is inactive.\n", crypt_get_dir(), name);
 		r = -ENODEV;
 		break;
 	case CRYPT_ACTIVE:
 	case CRYPT_BUSY:
-		log_std("%s/%s is active%s.\n", crypt_get_dir(), action_argv[0],
+		log_std("%s/%s is active%s.\n", crypt_get_dir(), name,
 			ci == CRYPT_BUSY ? " and is in use" : "");
-		r = crypt_init_by_name(&cd, action_argv[0]);
+		r = crypt_init_by_name(&cd, name);
 		if (r < 0 || !crypt_get_type(cd))
 			goto out;
 
 		log_std("  type:    %s\n", crypt_get_type(cd));
 
-		r = crypt_get_active_device(cd, action_argv[0], &cad);
+		r = crypt_get_active_device(cd, name, &cad);
 		if (r < 0)
 			goto out;
 
@@ -420,6 +448,109 @@ out:
 	return r;
 }
 
+/*
+ * One JSON object, without trailing newline (can be part of list).
+ * Object is printed in every case, status unknown is "active": null.
+ */
+static int status_json(const char *name)
+{
+	crypt_status_info ci;
+	struct crypt_active_device cad;
+	struct crypt_device *cd = NULL;
+	char *backing_file;
+	const char *device;
+	int r;
+
+	ci = crypt_status(NULL, name);
+
+	log_std("{ \"name\": ");
+	json_string(name);
+	if (ci == CRYPT_INVALID) {
+		log_std(", \"active\": null }");
+		return -EINVAL;
+	}
+	if (ci == CRYPT_INACTIVE) {
+		log_std(", \"active\": false }");
+		return -ENODEV;
+	}
+	log_std(", \"active\": true, \"busy\": %s",
+		ci == CRYPT_BUSY ? "true" : "false");
+
+	r = crypt_init_by_name(&cd, name);
+	if (r < 0 || !crypt_get_type(cd))
+		goto out;
+
+	log_std(", \"type\": ");
+	json_string(crypt_get_type(cd));
+
+	r = crypt_get_active_device(cd, name, &cad);
+	if (r < 0)
+		goto out;
+
+	log_std(", \"cipher\": ");
+	json_string(crypt_get_cipher(cd));
+	log_std(", \"cipher_mode\": ");
+	json_string(crypt_get_cipher_mode(cd));
+	log_std(", \"keysize\": %d, \"device\": ",
+		crypt_get_volume_key_size(cd) * 8);
+	device = crypt_get_device_name(cd);
+	json_string(device);
+	if (crypt_loop_device(device)) {
+		backing_file = crypt_loop_backing_file(device);
+		log_std(", \"loop\": ");
+		json_string(backing_file);
+		free(backing_file);
+	}
+	log_std(", \"offset\": %" PRIu64 ", \"size\": %" PRIu64
+		", \"skipped\": %" PRIu64, cad.offset, cad.size, cad.iv_offset);
+	log_std(", \"readonly\": %s, \"discards\": %s",
+		cad.flags & CRYPT_ACTIVATE_READONLY ? "true" : "false",
+		cad.flags & CRYPT_ACTIVATE_ALLOW_DISCARDS ? "true" : "false");
+out:
+	log_std(" }");
+	crypt_free(cd);
+	return r;
+}
+
+/* With --all, devices are found in one device-mapper list call */
+static int action_status(int arg __attribute__((unused)))
+{
+	struct crypt_active_entry *list = NULL;
+	int i, count, r;
+
+	if (!opt_all) {
+		if (!opt_json)
+			return status_text(action_argv[0]);
+		r = status_json(action_argv[0]);
+		log_std("\n");
+		return r;
+	}
+
+	count = crypt_list_active(&list);
+	if (count < 0)
+		return count;
+
+	if (opt_json)
+		log_std("{ \"devices\": [\n");
+
+	/* Device can disappear after listing, its status is still printed */
+	for (i = 0; i < count; i++) {
+		if (!opt_json) {
+			(void)status_text(list[i].name);
+			continue;
+		}
+		log_std("  ");
+		(void)status_json(list[i].name);
+		log_std("%s\n", i < count - 1 ? "," : "");
+	}
+
+	if (opt_json)
+		log_std("] }\n");
+
+	crypt_free_active_list(list, count);
+	return 0;
+}
+
 static int _read_mk(const char *file, char **key, int keysize)
 {
 	int fd;
@@ -483,6 +614,9 @@ static int action_luksFormat(int arg __attribute__((unused)))
 	if ((r = crypt_init(&cd, header_device)))
 		goto out;
 
+	if (opt_debug)
+		crypt_set_timing_callback(cd, _timing, NULL);
+
 	keysize = (opt_key_size ?: DEFAULT_LUKS1_KEYBITS) / 8;
 
 	crypt_set_password_verify(cd, 1);
@@ -541,6 +675,9 @@ static int action_luksOpen(int arg __attribute__((unused)))
 	if ((r = crypt_init(&cd, header_device)))
 		goto out;
 
+	if (opt_debug)
+		crypt_set_timing_callback(cd, _timing, NULL);
+
 	if ((r = crypt_load(cd, CRYPT_LUKS1, NULL)))
 		goto out;
 
@@ -675,6 +812,8 @@ static int action_luksRemoveKey(int arg __attribute__((unused)))
 
 	crypt_set_confirm_callback(cd, _yesDialog, NULL);
 	crypt_set_timeout(cd, opt_timeout);
+	if (opt_debug)
+		crypt_set_timing_callback(cd, _timing, NULL);
 
 	if ((r = crypt_load(cd, CRYPT_LUKS1, NULL)))
 		goto out;
@@ -722,6 +861,8 @@ static int action_luksAddKey(int arg __attribute__((unused)))
 		goto out;
 
 	crypt_set_confirm_callback(cd, _yesDialog, NULL);
+	if (opt_debug)
+		crypt_set_timing_callback(cd, _timing, NULL);
 
 	if ((r = crypt_load(cd, CRYPT_LUKS1, NULL)))
 		goto out;
@@ -775,6 +916,9 @@ static int action_luksChangeKey(int arg __attribute__((unused)))
 	if ((r = crypt_init(&cd, action_argv[0])))
 		goto out;
 
+	if (opt_debug)
+		crypt_set_timing_callback(cd, _timing, NULL);
+
 	if ((r = crypt_load(cd, CRYPT_LUKS1, NULL)))
 		goto out;
 
@@ -955,6 +1099,8 @@ static int action_luksDump(int arg __attribute__((unused)))
 
 	if (opt_dump_master_key)
 		r = luksDump_with_volume_key(cd);
+	else if (opt_json)
+		r = crypt_dump_json(cd);
 	else
 		r = crypt_dump(cd);
 out:
@@ -997,6 +1143,436 @@ out:
 	return r;
 }
 
+/* LUKS1 on-disk header size, the rest of first 4096 bytes is wiped in backup */
+#define LUKS_PHDR_BYTES		592
+#define LUKS_ALIGN_KEYSLOTS	4096
+#define BACKUP_JOBS_MAX		16
+#define BACKUP_MANIFEST		"MANIFEST"
+#define BACKUP_MANIFEST_NEW	"MANIFEST.new"
+#define BACKUP_SKIPPED		2
+
+static uint32_t _crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	int i;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320U & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static int _read_all(const char *path, char *buf, size_t size)
+{
+	ssize_t r;
+	size_t done = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -EINVAL;
+
+	while (done < size) {
+		r = read(fd, buf + done, size - done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		done += r;
+	}
+	close(fd);
+
+	return done == size ? 0 : -EIO;
+}
+
+/*
+ * Check that backup is loadable as standalone LUKS header, that it matches
+ * header area on device and compute its checksum for manifest.
+ */
+static int _verify_header_backup(const char *device, const char *backup_file,
+				 const char *uuid, size_t *size, uint32_t *crc)
+{
+	struct crypt_device *cd = NULL;
+	char *backup = NULL, *live = NULL;
+	struct stat st;
+	int r;
+
+	if ((r = crypt_init(&cd, backup_file)) ||
+	    (r = crypt_load(cd, CRYPT_LUKS1, NULL)))
+		goto out;
+
+	if (strcmp(crypt_get_uuid(cd) ?: "", uuid)) {
+		log_err(_("Header backup %s has different UUID than device %s.\n"),
+			backup_file, device);
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (stat(backup_file, &st) < 0 || st.st_size < LUKS_ALIGN_KEYSLOTS) {
+		r = -EINVAL;
+		goto out;
+	}
+	*size = st.st_size;
+
+	backup = crypt_safe_alloc(*size);
+	live = crypt_safe_alloc(*size);
+	if (!backup || !live) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	if ((r = _read_all(backup_file, backup, *size)) ||
+	    (r = _read_all(device, live, *size)))
+		goto out;
+
+	memset(live + LUKS_PHDR_BYTES, 0, LUKS_ALIGN_KEYSLOTS - LUKS_PHDR_BYTES);
+	if (memcmp(backup, live, *size)) {
+		log_err(_("Header backup %s does not match device %s.\n"),
+			backup_file, device);
+		r = -EINVAL;
+		goto out;
+	}
+
+	*crc = _crc32(0, (unsigned char *)backup, *size);
+out:
+	crypt_safe_free(backup);
+	crypt_safe_free(live);
+	crypt_free(cd);
+	return r;
+}
+
+/*
+ * Backup file name is prefixed by device index, basename alone
+ * is not unique (e.g. /dev/sda1 and /dev/disk/foo/sda1).
+ */
+static int _backup_header_to_archive(const char *device, int index, int manifest_fd)
+{
+	struct crypt_device *cd = NULL;
+	const char *name, *uuid;
+	char *backup_name = NULL, *backup_file = NULL, *line = NULL;
+	size_t size = 0;
+	uint32_t crc = 0;
+	int len, r;
+
+	if (opt_all && crypt_probe_luks1(device, NULL))
+		return BACKUP_SKIPPED;
+
+	name = strrchr(device, '/');
+	name = name ? name + 1 : device;
+	if (asprintf(&backup_name, "%d-%s.img", index, name) == -1)
+		return -ENOMEM;
+	if (asprintf(&backup_file, "%s/%s", opt_header_backup_file, backup_name) == -1) {
+		free(backup_name);
+		return -ENOMEM;
+	}
+
+	if ((r = crypt_init(&cd, device)) ||
+	    (r = crypt_load(cd, CRYPT_LUKS1, NULL)))
+		goto out;
+
+	crypt_set_confirm_callback(cd, _yesDialog, NULL);
+
+	if ((r = crypt_header_backup(cd, CRYPT_LUKS1, backup_file)))
+		goto out;
+
+	uuid = crypt_get_uuid(cd) ?: "";
+	if ((r = _verify_header_backup(device, backup_file, uuid, &size, &crc)))
+		goto out;
+
+	/* One write per line, O_APPEND keeps lines from workers intact */
+	len = asprintf(&line, "%s %s %s %zu %08x\n", device, uuid, backup_name, size, crc);
+	if (len == -1) {
+		r = -ENOMEM;
+		goto out;
+	}
+	if (write(manifest_fd, line, len) != len) {
+		log_err(_("Cannot write to %s/%s.\n"), opt_header_backup_file, BACKUP_MANIFEST_NEW);
+		r = -EIO;
+		goto out;
+	}
+
+	log_verbose(_("Header of device %s stored to %s.\n"), device, backup_file);
+out:
+	if (r < 0)
+		log_err(_("Header backup of device %s failed.\n"), device);
+	crypt_free(cd);
+	free(backup_name);
+	free(backup_file);
+	free(line);
+	return r;
+}
+
+static int _scan_partitions(char ***devices, int *count)
+{
+	char line[256], name[128], **tmp;
+	unsigned int major, minor;
+	unsigned long long blocks;
+	FILE *f;
+
+	f = fopen("/proc/partitions", "r");
+	if (!f) {
+		log_err(_("Cannot read list of block devices.\n"));
+		return -EINVAL;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%u %u %llu %127s", &major, &minor, &blocks, name) != 4)
+			continue;
+
+		tmp = realloc(*devices, (*count + 1) * sizeof(char *));
+		if (!tmp)
+			break;
+		*devices = tmp;
+
+		if (asprintf(&(*devices)[*count], "/dev/%s", name) == -1)
+			break;
+		(*count)++;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static const char *bench_hashes[] = {
+	"sha1", "sha256", "sha512", "ripemd160", "whirlpool", NULL
+};
+
+static struct {
+	const char *cipher;
+	const char *mode;
+	size_t key_size;
+} bench_ciphers[] = {
+	{ "aes",     "cbc-essiv:sha256", 16 },
+	{ "aes",     "cbc-essiv:sha256", 32 },
+	{ "serpent", "cbc-essiv:sha256", 16 },
+	{ "serpent", "cbc-essiv:sha256", 32 },
+	{ "twofish", "cbc-essiv:sha256", 16 },
+	{ "twofish", "cbc-essiv:sha256", 32 },
+	{ "aes",     "xts-plain64",      32 },
+	{ "aes",     "xts-plain64",      64 },
+	{ "serpent", "xts-plain64",      32 },
+	{ "serpent", "xts-plain64",      64 },
+	{ "twofish", "xts-plain64",      32 },
+	{ "twofish", "xts-plain64",      64 },
+	{ NULL, NULL, 0 }
+};
+
+/*
+ * Output is one result per line with whitespace separated columns,
+ * lines starting with '#' are comments.
+ */
+static int benchmark_cipher_line(const char *cipher, const char *mode,
+				 size_t key_size, int last)
+{
+	double enc_mbr = 0, dec_mbr = 0;
+	int r;
+
+	r = crypt_benchmark(NULL, cipher, mode, key_size,
+			    1024 * 1024, &enc_mbr, &dec_mbr);
+	if (opt_json) {
+		log_std("    { \"cipher\": ");
+		json_string(cipher);
+		log_std(", \"mode\": ");
+		json_string(mode);
+		log_std(", \"key_bits\": %zu, ", key_size * 8);
+		if (r < 0)
+			log_std("\"encryption_mibs\": null, \"decryption_mibs\": null }");
+		else
+			log_std("\"encryption_mibs\": %.1f, \"decryption_mibs\": %.1f }",
+				enc_mbr, dec_mbr);
+		log_std("%s\n", last ? "" : ",");
+	} else if (r < 0)
+		log_std("%s-%-20s %4zu %10s %10s\n", cipher, mode,
+			key_size * 8, "N/A", "N/A");
+	else
+		log_std("%s-%-20s %4zu %10.1f %10.1f\n", cipher, mode,
+			key_size * 8, enc_mbr, dec_mbr);
+
+	return r;
+}
+
+static int action_benchmark(int arg __attribute__((unused)))
+{
+	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
+	uint64_t iterations;
+	int i, r;
+
+	if (opt_json)
+		log_std("{\n");
+	else
+		log_std(_("# Tests are approximate using memory only (no storage IO).\n"));
+
+	if (opt_cipher) {
+		r = crypt_parse_name_and_mode(opt_cipher, cipher, NULL, cipher_mode);
+		if (r < 0) {
+			log_err(_("No known cipher specification pattern detected.\n"));
+			return r;
+		}
+
+		if (opt_json)
+			log_std("  \"cipher\": [\n");
+		else
+			log_std("# cipher key_bits encryption_MiB/s decryption_MiB/s\n");
+		r = benchmark_cipher_line(cipher, cipher_mode,
+				(opt_key_size ?: DEFAULT_LUKS1_KEYBITS) / 8, 1);
+		if (opt_json)
+			log_std("  ]\n}\n");
+
+		/* Requested cipher must be available, N/A is an error */
+		if (r == -ENOENT)
+			log_err(_("Cipher %s is not available.\n"), opt_cipher);
+		else if (r == -ENOTSUP)
+			log_err(_("Kernel userspace crypto API is not available.\n"));
+		return r;
+	}
+
+	if (opt_json)
+		log_std("  \"kdf\": [\n");
+	else
+		log_std("# kdf-hash iterations_per_second\n");
+	for (i = 0; bench_hashes[i]; i++) {
+		r = crypt_benchmark_kdf(NULL, "pbkdf2", bench_hashes[i], &iterations);
+		if (opt_json) {
+			log_std("    { \"kdf\": \"pbkdf2\", \"hash\": \"%s\", ",
+				bench_hashes[i]);
+			if (r < 0)
+				log_std("\"iterations_per_second\": null }");
+			else
+				log_std("\"iterations_per_second\": %" PRIu64 " }",
+					iterations);
+			log_std("%s\n", bench_hashes[i + 1] ? "," : "");
+		} else if (r < 0)
+			log_std("pbkdf2-%-10s %12s\n", bench_hashes[i], "N/A");
+		else
+			log_std("pbkdf2-%-10s %12" PRIu64 "\n", bench_hashes[i],
+				iterations);
+	}
+
+	if (opt_json)
+		log_std("  ],\n  \"cipher\": [\n");
+	else
+		log_std("# cipher key_bits encryption_MiB/s decryption_MiB/s\n");
+	for (i = 0; bench_ciphers[i].cipher; i++)
+		benchmark_cipher_line(bench_ciphers[i].cipher,
+				      bench_ciphers[i].mode,
+				      bench_ciphers[i].key_size,
+				      !bench_ciphers[i + 1].cipher);
+
+	if (opt_json)
+		log_std("  ]\n}\n");
+	return 0;
+}
+
+/*
+ * Bulk mode, every device is processed in separate process so the devices
+ * are probed and read in parallel. Backups are stored in archive directory
+ * together with manifest containing UUID, size and checksum of each backup.
+ * Existing backups are never overwritten, so archive with manifest
+ * is refused. Manifest is renamed to its final name after all workers
+ * finished, interrupted run leaves no manifest.
+ */
+static int action_luksBackupArchive(void)
+{
+	char **devices = NULL, *manifest = NULL, *manifest_new = NULL;
+	int i, count, jobs = 0, stored = 0, failed = 0, manifest_fd = -1, status, r;
+	pid_t pid;
+
+	if (opt_all) {
+		count = 0;
+		if ((r = _scan_partitions(&devices, &count)))
+			goto out;
+	} else {
+		devices = (char **)action_argv;
+		count = action_argc;
+	}
+
+	if (mkdir(opt_header_backup_file, S_IRWXU) < 0 && errno != EEXIST) {
+		log_err(_("Cannot create header archive directory %s.\n"),
+			opt_header_backup_file);
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (asprintf(&manifest, "%s/%s", opt_header_backup_file, BACKUP_MANIFEST) == -1 ||
+	    asprintf(&manifest_new, "%s/%s", opt_header_backup_file, BACKUP_MANIFEST_NEW) == -1) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	if (!access(manifest, F_OK)) {
+		log_err(_("Header archive %s already exists, use another directory.\n"),
+			opt_header_backup_file);
+		r = -EEXIST;
+		goto out;
+	}
+
+	manifest_fd = open(manifest_new, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+			   S_IRUSR | S_IWUSR);
+	if (manifest_fd == -1) {
+		log_err(_("Cannot write to %s.\n"), manifest_new);
+		r = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < count || jobs; ) {
+		if (i < count && jobs < BACKUP_JOBS_MAX) {
+			fflush(stdout);
+			fflush(stderr);
+			pid = fork();
+			if (pid == -1) {
+				log_err(_("Cannot start header backup process.\n"));
+				failed += count - i;
+				i = count;
+				continue;
+			}
+			if (!pid) {
+				r = _backup_header_to_archive(devices[i], i, manifest_fd);
+				fflush(stdout);
+				fflush(stderr);
+				_exit(r < 0 ? EXIT_FAILURE : r);
+			}
+			jobs++;
+			i++;
+			continue;
+		}
+
+		if (waitpid(-1, &status, 0) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		jobs--;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+			stored++;
+		else if (!WIFEXITED(status) || WEXITSTATUS(status) != BACKUP_SKIPPED)
+			failed++;
+	}
+
+	if (fsync(manifest_fd) < 0 || rename(manifest_new, manifest) < 0) {
+		log_err(_("Cannot write to %s.\n"), manifest);
+		r = -EIO;
+		goto out;
+	}
+
+	log_verbose(_("%d header(s) stored to %s, %d failed.\n"),
+		    stored, opt_header_backup_file, failed);
+	r = failed ? -EIO : 0;
+out:
+	if (manifest_fd != -1)
+		close(manifest_fd);
+	free(manifest);
+	free(manifest_new);
+	if (opt_all) {
+		for (i = 0; i < count; i++)
+			free(devices[i]);
+		free(devices);
+	}
+	return r;
+}
+
 static int action_luksBackup(int arg __attribute__((unused)))
 {
 	struct crypt_device *cd = NULL;
@@ -1007,6 +1583,9 @@ static int action_luksBackup(int arg __attribute__((unused)))
 		return -EINVAL;
 	}
 
+	if (opt_all || action_argc > 1)
+		return action_luksBackupArchive();
+
 	if ((r = crypt_init(&cd, action_argv[0])))
 		goto out;
 
@@ -1182,6 +1761,8 @@ int main(int argc, const char **argv)
 		{ "uuid",              '\0', POPT_ARG_STRING, &opt_uuid,                0, N_("UUID for device to use."), NULL },
 		{ "allow-discards",    '\0', POPT_ARG_NONE, &opt_allow_discards,        0, N_("Allow discards (aka TRIM) requests for device."), NULL },
 		{ "header",            '\0', POPT_ARG_STRING, &opt_header_device,       0, N_("Device or file with separated LUKS header."), NULL },
+		{ "all",               '\0', POPT_ARG_NONE, &opt_all,                   0, N_("Process all LUKS devices found in system."), NULL },
+		{ "json",              '\0', POPT_ARG_NONE, &opt_json,                  0, N_("Print status, dump or benchmark as JSON."), NULL },
 		POPT_TABLEEND
 	};
 	poptContext popt_context;
@@ -1253,7 +1834,28 @@ int main(int argc, const char **argv)
 	while(action_argv[action_argc] != NULL)
 		action_argc++;
 
-	if(action_argc < action->required_action_argc) {
+	if (opt_all && strcmp(aname, "luksHeaderBackup") && strcmp(aname, "status"))
+		usage(popt_context, EXIT_FAILURE,
+		      _("Option --all is allowed only for luksHeaderBackup and status.\n"),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_json && strcmp(aname, "status") && strcmp(aname, "luksDump") &&
+	    strcmp(aname, "benchmark"))
+		usage(popt_context, EXIT_FAILURE,
+		      _("Option --json is allowed only for status, luksDump and benchmark.\n"),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_json && opt_dump_master_key)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Option --json cannot be combined with --dump-master-key.\n"),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_all && action_argc)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Option --all cannot be combined with device argument.\n"),
+		      poptGetInvocationName(popt_context));
+
+	if(action_argc < action->required_action_argc && !opt_all) {
 		char buf[128];
 		snprintf(buf, 128,_("%s: requires %s as arguments"), action->type, action->arg_desc);
 		usage(popt_context, EXIT_FAILURE, buf,
@@ -1280,9 +1882,10 @@ int main(int argc, const char **argv)
 	if (opt_key_size &&
 	   strcmp(aname, "luksFormat") &&
 	   strcmp(aname, "create") &&
-	   strcmp(aname, "loopaesOpen")) {
+	   strcmp(aname, "loopaesOpen") &&
+	   strcmp(aname, "benchmark")) {
 		usage(popt_context, EXIT_FAILURE,
-		      _("Option --key-size is allowed only for luksFormat, create and loopaesOpen.\n"
+		      _("Option --key-size is allowed only for luksFormat, create, loopaesOpen and benchmark.\n"
 		        "To limit read from keyfile use --keyfile-size=(bytes)."),
 		      poptGetInvocationName(popt_context));
 	}
@@ -0,0 +1,1496 @@
+/*
+ * cryptsetup-reencrypt - offline LUKS volume key and cipher change
+ *
+ * Copyright (C) 2011, Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The payload is read through a read-only mapping using the old header and
+ * written back in place through a second mapping using the new header.
+ * Both mappings use the same data offset, so every block is read and
+ * written at the same position and blocks can be processed in parallel.
+ *
+ * Before a window of blocks is overwritten, its raw (old) ciphertext is
+ * stored in the journal file and synced. If the process is interrupted,
+ * the saved window is written back on the next run and processing
+ * continues from the last committed position. The new header is written
+ * to the device only after the whole payload is reencrypted.
+ *
+ * With --active-name the device stays in use. The active mapping is
+ * switched by the library to three segments: reencrypted area (new key),
+ * hotzone with the current window and the rest (old key). Only the hotzone
+ * is suspended while the window is rewritten, the copy itself is done
+ * by the same worker threads as offline.
+ * Before the first switch the old header is moved to a file and the on-disk
+ * LUKS magic is replaced, so after a crash the half reencrypted device cannot
+ * be activated with the old key. The new header removes the mark.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <libcryptsetup.h>
+#include <popt.h>
+
+#include "cryptsetup.h"
+
+#define SECTOR_SIZE		512
+#define DEFAULT_REENCRYPT_BLOCK	4	/* MiB */
+#define MAX_REENCRYPT_BLOCK	64	/* MiB */
+#define MAX_REENCRYPT_THREADS	64
+#define MiB			(1024 * 1024)
+
+#define JOURNAL_MAGIC		"CRREJRN"
+#define JOURNAL_VERSION		1
+#define JOURNAL_HDR_SIZE	4096	/* saved ciphertext follows */
+#define IO_ALIGN		4096
+
+/* Must match LUKS_REENCRYPT_MAGIC in library */
+#define REENCRYPT_MAGIC		"SKUL\xba\xbe"
+#define REENCRYPT_MAGIC_L	6
+
+static int opt_verbose = 0;
+static int opt_debug = 0;
+static const char *opt_cipher = NULL;
+static const char *opt_hash = NULL;
+static const char *opt_key_file = NULL;
+static const char *opt_uuid = NULL;
+static long opt_keyfile_size = 0;
+static int opt_key_size = 0;
+static int opt_key_slot = CRYPT_ANY_SLOT;
+static int opt_iteration_time = 1000;
+static int opt_batch_mode = 0;
+static int opt_version_mode = 0;
+static int opt_timeout = 0;
+static int opt_random = 0;
+static int opt_urandom = 0;
+static int opt_block_size = DEFAULT_REENCRYPT_BLOCK;
+static int opt_threads = 0;
+static int opt_max_rate = 0;
+static const char *opt_active_name = NULL;
+
+static const char **action_argv;
+
+enum {
+	JOURNAL_CLEAN = 0,	/* everything below position is reencrypted */
+	JOURNAL_PENDING,	/* window at position is saved in journal */
+	JOURNAL_DONE,		/* payload done, new header not yet written */
+};
+
+struct reenc_journal {
+	char magic[8];
+	uint32_t version;
+	uint32_t state;
+	uint64_t data_offset;	/* payload offset in sectors */
+	uint64_t data_size;	/* payload size in bytes */
+	uint64_t position;	/* bytes already reencrypted */
+	uint64_t length;	/* length of saved window (PENDING only) */
+	char uuid[40];
+};
+
+struct reenc_ctx;
+
+struct reenc_thread {
+	struct reenc_ctx *rc;
+	char *buf;
+	pthread_t tid;
+};
+
+struct reenc_ctx {
+	const char *device;
+	const char *active_name;	/* online reencryption of active device */
+	char header_new[PATH_MAX];
+	char header_org[PATH_MAX];	/* old header of marked device */
+	char journal_file[PATH_MAX];
+	char name_old[64];
+	char name_new[64];
+
+	struct crypt_device *cd_old;
+	struct crypt_device *cd_new;
+	int device_fd;
+	int journal_fd;
+	int old_fd;
+	int new_fd;
+
+	/* volume keys for online segment switching */
+	char *vk;
+	size_t vk_size;
+	char *vk_new;
+	size_t vk_new_size;
+
+	struct reenc_journal jh;
+	size_t block_size;
+	size_t window_size;
+	char *window;
+
+	/* worker pool, protected by lock */
+	struct reenc_thread *threads;
+	int thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t cond_work;
+	pthread_cond_t cond_done;
+	uint64_t next;
+	uint64_t end;
+	int busy;
+	int error;
+	int quit;
+};
+
+struct reenc_key {
+	char *password;
+	size_t passwordLen;
+};
+
+static volatile sig_atomic_t quit_requested = 0;
+
+__attribute__((format(printf, 5, 6)))
+static void clogger(struct crypt_device *cd, int level, const char *file,
+		   int line, const char *format, ...)
+{
+	va_list argp;
+	char *target = NULL;
+
+	va_start(argp, format);
+
+	if (vasprintf(&target, format, argp) > 0) {
+		if (level >= 0) {
+			crypt_log(cd, level, target);
+#ifdef CRYPT_DEBUG
+		} else if (opt_debug)
+			printf("# %s:%d %s\n", file ?: "?", line, target);
+#else
+		} else if (opt_debug)
+			printf("# %s\n", target);
+#endif
+	}
+
+	va_end(argp);
+	free(target);
+}
+
+static int _yesDialog(const char *msg, void *usrptr __attribute__((unused)))
+{
+	char *answer = NULL;
+	size_t size = 0;
+	int r = 1;
+
+	if(isatty(0) && !opt_batch_mode) {
+		log_std("\nWARNING!\n========\n");
+		log_std("%s\n\nAre you sure? (Type uppercase yes): ", msg);
+		if(getline(&answer, &size, stdin) == -1) {
+			perror("getline");
+			free(answer);
+			return 0;
+		}
+		if(strcmp(answer, "YES\n"))
+			r = 0;
+		free(answer);
+	}
+
+	return r;
+}
+
+static void _log(int level, const char *msg, void *usrptr __attribute__((unused)))
+{
+	switch(level) {
+
+	case CRYPT_LOG_NORMAL:
+		fputs(msg, stdout);
+		break;
+	case CRYPT_LOG_VERBOSE:
+		if (opt_verbose)
+			fputs(msg, stdout);
+		break;
+	case CRYPT_LOG_ERROR:
+		fputs(msg, stderr);
+		break;
+	case CRYPT_LOG_DEBUG:
+		if (opt_debug)
+			printf("# %s\n", msg);
+		break;
+	default:
+		fprintf(stderr, "Internal error on logging class for msg: %s", msg);
+		break;
+	}
+}
+
+static void _quit(int sig __attribute__((unused)))
+{
+	quit_requested = 1;
+}
+
+static double _time_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static ssize_t _pread_all(int fd, void *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < len) {
+		r = pread(fd, (char *)buf + done, len - done, offset + done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -EIO;
+		done += r;
+	}
+
+	return done;
+}
+
+static ssize_t _pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < len) {
+		r = pwrite(fd, (const char *)buf + done, len - done, offset + done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -EIO;
+		done += r;
+	}
+
+	return done;
+}
+
+/*
+ * Journal
+ */
+static int journal_write(struct reenc_ctx *rc)
+{
+	if (_pwrite_all(rc->journal_fd, &rc->jh, sizeof(rc->jh), 0) < 0 ||
+	    fdatasync(rc->journal_fd) < 0) {
+		log_err(_("Cannot write reencryption journal %s.\n"), rc->journal_file);
+		return -EIO;
+	}
+
+	log_dbg("Journal state %u, position %" PRIu64 ", length %" PRIu64 ".",
+		rc->jh.state, rc->jh.position, rc->jh.length);
+	return 0;
+}
+
+static int journal_read(struct reenc_ctx *rc)
+{
+	if (_pread_all(rc->journal_fd, &rc->jh, sizeof(rc->jh), 0) < 0 ||
+	    memcmp(rc->jh.magic, JOURNAL_MAGIC, sizeof(rc->jh.magic)) ||
+	    rc->jh.version != JOURNAL_VERSION ||
+	    rc->jh.state > JOURNAL_DONE ||
+	    rc->jh.position > rc->jh.data_size ||
+	    rc->jh.uuid[sizeof(rc->jh.uuid) - 1]) {
+		log_err(_("Reencryption journal %s is corrupted.\n"), rc->journal_file);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int journal_create(struct reenc_ctx *rc, const char *uuid,
+			  uint64_t data_offset, uint64_t data_size)
+{
+	char tmp_file[PATH_MAX + 4];
+	int r;
+
+	memset(&rc->jh, 0, sizeof(rc->jh));
+	memcpy(rc->jh.magic, JOURNAL_MAGIC, sizeof(rc->jh.magic));
+	rc->jh.version = JOURNAL_VERSION;
+	rc->jh.state = JOURNAL_CLEAN;
+	rc->jh.data_offset = data_offset;
+	rc->jh.data_size = data_size;
+	strncpy(rc->jh.uuid, uuid, sizeof(rc->jh.uuid) - 1);
+
+	/* journal must never be seen half written, create it under other name */
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", rc->journal_file);
+	unlink(tmp_file);
+
+	rc->journal_fd = open(tmp_file, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (rc->journal_fd == -1) {
+		log_err(_("Cannot create reencryption journal %s.\n"), rc->journal_file);
+		return -EINVAL;
+	}
+
+	r = journal_write(rc);
+	if (!r && rename(tmp_file, rc->journal_file) < 0) {
+		log_err(_("Cannot create reencryption journal %s.\n"), rc->journal_file);
+		r = -EINVAL;
+	}
+
+	if (r < 0)
+		unlink(tmp_file);
+	return r;
+}
+
+/* Store raw ciphertext of the window before it is overwritten */
+static int journal_save_window(struct reenc_ctx *rc, size_t len)
+{
+	off_t offset = rc->jh.data_offset * SECTOR_SIZE + rc->jh.position;
+
+	if (_pread_all(rc->device_fd, rc->window, len, offset) < 0) {
+		log_err(_("Cannot read device %s.\n"), rc->device);
+		return -EIO;
+	}
+
+	if (_pwrite_all(rc->journal_fd, rc->window, len, JOURNAL_HDR_SIZE) < 0 ||
+	    fdatasync(rc->journal_fd) < 0) {
+		log_err(_("Cannot write reencryption journal %s.\n"), rc->journal_file);
+		return -EIO;
+	}
+
+	rc->jh.state = JOURNAL_PENDING;
+	rc->jh.length = len;
+	return journal_write(rc);
+}
+
+/* Put back old ciphertext of interrupted window */
+static int journal_replay(struct reenc_ctx *rc)
+{
+	off_t offset = rc->jh.data_offset * SECTOR_SIZE + rc->jh.position;
+	char *buf = NULL;
+	int r = -EIO;
+
+	if (rc->jh.state != JOURNAL_PENDING)
+		return 0;
+
+	log_verbose("Restoring interrupted window at offset %" PRIu64 ".\n",
+		    rc->jh.position);
+
+	if (!rc->jh.length || rc->jh.length % SECTOR_SIZE ||
+	    rc->jh.position + rc->jh.length > rc->jh.data_size) {
+		log_err(_("Reencryption journal %s is corrupted.\n"), rc->journal_file);
+		return -EINVAL;
+	}
+
+	if (posix_memalign((void *)&buf, IO_ALIGN, rc->jh.length))
+		return -ENOMEM;
+
+	if (_pread_all(rc->journal_fd, buf, rc->jh.length, JOURNAL_HDR_SIZE) < 0) {
+		log_err(_("Cannot read reencryption journal %s.\n"), rc->journal_file);
+		goto out;
+	}
+
+	if (_pwrite_all(rc->device_fd, buf, rc->jh.length, offset) < 0 ||
+	    fdatasync(rc->device_fd) < 0) {
+		log_err(_("Cannot write to device %s.\n"), rc->device);
+		goto out;
+	}
+
+	rc->jh.state = JOURNAL_CLEAN;
+	rc->jh.length = 0;
+	r = journal_write(rc);
+out:
+	free(buf);
+	return r;
+}
+
+/*
+ * Keys and headers
+ */
+static void free_keys(struct reenc_key *keys, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		crypt_safe_free(keys[i].password);
+	free(keys);
+}
+
+/*
+ * Get passphrase for all keyslots which are kept in the new header.
+ * With key file or explicit key slot only that one keyslot is kept.
+ * Returns number of one unlocked keyslot.
+ */
+static int get_keys(struct crypt_device *cd, struct reenc_key *keys, int all)
+{
+	crypt_keyslot_info ki;
+	char msg[64];
+	int i, r, keyslot = -ENOENT;
+
+	if (!all) {
+		r = crypt_get_key(_("Enter passphrase: "), &keys[0].password,
+				  &keys[0].passwordLen, opt_keyfile_size,
+				  opt_key_file, opt_timeout, 0, cd);
+		if (r < 0)
+			return r;
+
+		r = crypt_activate_by_passphrase(cd, NULL, opt_key_slot,
+			keys[0].password, keys[0].passwordLen, 0);
+		if (r < 0) {
+			log_err(_("No key available with this passphrase.\n"));
+			return r;
+		}
+
+		/* keep key in the unlocked slot position */
+		if (r) {
+			keys[r] = keys[0];
+			keys[0].password = NULL;
+			keys[0].passwordLen = 0;
+		}
+		return r;
+	}
+
+	for (i = 0; i < crypt_keyslot_max(CRYPT_LUKS1); i++) {
+		ki = crypt_keyslot_status(cd, i);
+		if (ki != CRYPT_SLOT_ACTIVE && ki != CRYPT_SLOT_ACTIVE_LAST)
+			continue;
+
+		snprintf(msg, sizeof(msg), _("Enter passphrase for key slot %u: "), i);
+		r = crypt_get_key(msg, &keys[i].password, &keys[i].passwordLen,
+				  0, NULL, opt_timeout, 0, cd);
+		if (r < 0)
+			return r;
+
+		r = crypt_activate_by_passphrase(cd, NULL, i, keys[i].password,
+						 keys[i].passwordLen, 0);
+		if (r < 0) {
+			log_err(_("No key available with this passphrase.\n"));
+			return r;
+		}
+
+		if (keyslot < 0)
+			keyslot = i;
+	}
+
+	return keyslot;
+}
+
+static int create_new_header(struct reenc_ctx *rc, struct crypt_device *cd,
+			     struct reenc_key *keys)
+{
+	struct crypt_device *cd_new = NULL;
+	struct crypt_params_luks1 params = {
+		.hash = opt_hash ?: DEFAULT_LUKS1_HASH,
+		.data_alignment = crypt_get_data_offset(cd),
+	};
+	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
+	int i, fd, r, key_size;
+
+	if (opt_cipher) {
+		r = crypt_parse_name_and_mode(opt_cipher, cipher, NULL, cipher_mode);
+		if (r < 0) {
+			log_err(_("No known cipher specification pattern detected.\n"));
+			return r;
+		}
+	} else {
+		strncpy(cipher, crypt_get_cipher(cd), MAX_CIPHER_LEN - 1);
+		strncpy(cipher_mode, crypt_get_cipher_mode(cd), MAX_CIPHER_LEN - 1);
+		cipher[MAX_CIPHER_LEN - 1] = '\0';
+		cipher_mode[MAX_CIPHER_LEN - 1] = '\0';
+	}
+
+	key_size = opt_key_size ? opt_key_size / 8 : crypt_get_volume_key_size(cd);
+
+	/* The new header is created in image file of the old header size */
+	unlink(rc->header_new);
+	fd = open(rc->header_new, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd == -1 ||
+	    ftruncate(fd, crypt_get_data_offset(cd) * SECTOR_SIZE) < 0) {
+		log_err(_("Cannot create new header file %s.\n"), rc->header_new);
+		if (fd != -1)
+			close(fd);
+		return -EINVAL;
+	}
+	close(fd);
+
+	if ((r = crypt_init(&cd_new, rc->header_new)))
+		goto out;
+
+	if (opt_iteration_time)
+		crypt_set_iterarion_time(cd_new, opt_iteration_time);
+
+	if (opt_random)
+		crypt_set_rng_type(cd_new, CRYPT_RNG_RANDOM);
+	else if (opt_urandom)
+		crypt_set_rng_type(cd_new, CRYPT_RNG_URANDOM);
+
+	r = crypt_format(cd_new, CRYPT_LUKS1, cipher, cipher_mode,
+			 crypt_get_uuid(cd), NULL, key_size, &params);
+	if (r < 0)
+		goto out;
+
+	if (crypt_get_data_offset(cd_new) != crypt_get_data_offset(cd)) {
+		log_err(_("New LUKS header does not fit into space of the old one.\n"));
+		r = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < crypt_keyslot_max(CRYPT_LUKS1); i++) {
+		if (!keys[i].password)
+			continue;
+
+		r = crypt_keyslot_add_by_volume_key(cd_new, i, NULL, 0,
+				keys[i].password, keys[i].passwordLen);
+		if (r < 0)
+			goto out;
+		log_verbose(_("Key slot %d created.\n"), i);
+	}
+	r = 0;
+out:
+	crypt_free(cd_new);
+	if (r < 0)
+		unlink(rc->header_new);
+	return r;
+}
+
+/* Copy new header and keyslots over the old one */
+static int write_new_header(struct reenc_ctx *rc)
+{
+	size_t size = rc->jh.data_offset * SECTOR_SIZE;
+	char *buf = NULL;
+	int fd, r = -EIO;
+
+	/* device is open with O_DIRECT, keyslots are stored encrypted anyway */
+	if (posix_memalign((void *)&buf, IO_ALIGN, size))
+		return -ENOMEM;
+
+	fd = open(rc->header_new, O_RDONLY);
+	if (fd == -1 || _pread_all(fd, buf, size, 0) < 0) {
+		log_err(_("Cannot read new header file %s.\n"), rc->header_new);
+		goto out;
+	}
+
+	if (_pwrite_all(rc->device_fd, buf, size, 0) < 0 ||
+	    fdatasync(rc->device_fd) < 0) {
+		log_err(_("Cannot write to device %s.\n"), rc->device);
+		goto out;
+	}
+
+	log_verbose(_("New LUKS header written to device %s.\n"), rc->device);
+	r = 0;
+out:
+	if (fd != -1)
+		close(fd);
+	free(buf);
+	return r;
+}
+
+/*
+ * Keep the old header in a file and mark the on-disk one.
+ * Library refuses to load marked header until the new one is written.
+ */
+static int mark_header(struct reenc_ctx *rc)
+{
+	size_t size = rc->jh.data_offset * SECTOR_SIZE;
+	char tmp_file[PATH_MAX + 4];
+	char *buf = NULL;
+	int fd = -1, r = -EIO;
+
+	if (posix_memalign((void *)&buf, IO_ALIGN, size))
+		return -ENOMEM;
+
+	/* Repeated run, device can be already marked */
+	fd = open(rc->header_org, O_RDONLY);
+	if (fd != -1) {
+		if (_pread_all(fd, buf, size, 0) < 0) {
+			log_err(_("Cannot read header file %s.\n"), rc->header_org);
+			goto out;
+		}
+	} else {
+		if (_pread_all(rc->device_fd, buf, size, 0) < 0) {
+			log_err(_("Cannot read device %s.\n"), rc->device);
+			goto out;
+		}
+
+		snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", rc->header_org);
+		unlink(tmp_file);
+		fd = open(tmp_file, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+		if (fd == -1 || _pwrite_all(fd, buf, size, 0) < 0 ||
+		    fsync(fd) < 0 || rename(tmp_file, rc->header_org) < 0) {
+			log_err(_("Cannot create header file %s.\n"), rc->header_org);
+			unlink(tmp_file);
+			goto out;
+		}
+	}
+
+	memcpy(buf, REENCRYPT_MAGIC, REENCRYPT_MAGIC_L);
+	if (_pwrite_all(rc->device_fd, buf, size, 0) < 0 ||
+	    fdatasync(rc->device_fd) < 0) {
+		log_err(_("Cannot write to device %s.\n"), rc->device);
+		goto out;
+	}
+
+	log_dbg("Header of %s marked, old header saved to %s.",
+		rc->device, rc->header_org);
+	r = 0;
+out:
+	if (fd != -1)
+		close(fd);
+	free(buf);
+	return r;
+}
+
+/* Old header is in file if the device was marked */
+static int load_old_header(struct reenc_ctx *rc, struct crypt_device **cd)
+{
+	int r;
+
+	if (access(rc->header_org, F_OK)) {
+		if ((r = crypt_init(cd, rc->device)) ||
+		    (r = crypt_load(*cd, CRYPT_LUKS1, NULL)))
+			return r;
+		return 0;
+	}
+
+	log_dbg("Using old header from %s.", rc->header_org);
+	if ((r = crypt_init(cd, rc->header_org)) ||
+	    (r = crypt_load(*cd, CRYPT_LUKS1, NULL)) ||
+	    (r = crypt_set_data_device(*cd, rc->device)))
+		return r;
+
+	return 0;
+}
+
+/*
+ * Mappings
+ */
+static int get_volume_key(struct crypt_device *cd, int keyslot,
+			  const char *password, size_t passwordLen,
+			  char **vk, size_t *vk_size)
+{
+	*vk_size = crypt_get_volume_key_size(cd);
+	*vk = crypt_safe_alloc(*vk_size);
+	if (!*vk)
+		return -ENOMEM;
+
+	return crypt_volume_key_get(cd, keyslot, *vk, vk_size,
+				    password, passwordLen);
+}
+
+static int activate_mappings(struct reenc_ctx *rc, const char *password,
+			     size_t passwordLen, int keyslot)
+{
+	char path[PATH_MAX];
+	uint32_t shared = rc->active_name ? CRYPT_ACTIVATE_SHARED : 0;
+	int r;
+
+	snprintf(rc->name_old, sizeof(rc->name_old),
+		 "temporary-cryptsetup-reencrypt-%d-old", getpid());
+	snprintf(rc->name_new, sizeof(rc->name_new),
+		 "temporary-cryptsetup-reencrypt-%d-new", getpid());
+
+	r = load_old_header(rc, &rc->cd_old);
+	if (r < 0)
+		return r;
+
+	r = crypt_activate_by_passphrase(rc->cd_old, rc->name_old, keyslot,
+		password, passwordLen,
+		CRYPT_ACTIVATE_READONLY | CRYPT_ACTIVATE_PRIVATE | shared);
+	if (r < 0)
+		return r;
+
+	if ((r = crypt_init(&rc->cd_new, rc->header_new)) ||
+	    (r = crypt_load(rc->cd_new, CRYPT_LUKS1, NULL)) ||
+	    (r = crypt_set_data_device(rc->cd_new, rc->device)))
+		return r;
+
+	r = crypt_activate_by_passphrase(rc->cd_new, rc->name_new, keyslot,
+		password, passwordLen,
+		CRYPT_ACTIVATE_SHARED | CRYPT_ACTIVATE_PRIVATE);
+	if (r < 0)
+		return r;
+
+	if (rc->active_name) {
+		r = get_volume_key(rc->cd_old, keyslot, password, passwordLen,
+				   &rc->vk, &rc->vk_size);
+		if (r >= 0)
+			r = get_volume_key(rc->cd_new, keyslot, password,
+					   passwordLen, &rc->vk_new, &rc->vk_new_size);
+		if (r < 0)
+			return r;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", crypt_get_dir(), rc->name_old);
+	rc->old_fd = open(path, O_RDONLY | O_DIRECT);
+	snprintf(path, sizeof(path), "%s/%s", crypt_get_dir(), rc->name_new);
+	rc->new_fd = open(path, O_RDWR | O_DIRECT);
+	if (rc->old_fd == -1 || rc->new_fd == -1) {
+		log_err(_("Cannot open temporary reencryption devices.\n"));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void deactivate_mappings(struct reenc_ctx *rc)
+{
+	if (rc->old_fd != -1)
+		close(rc->old_fd);
+	if (rc->new_fd != -1)
+		close(rc->new_fd);
+	rc->old_fd = rc->new_fd = -1;
+
+	if (rc->cd_old && crypt_status(rc->cd_old, rc->name_old) == CRYPT_ACTIVE)
+		crypt_deactivate(rc->cd_old, rc->name_old);
+	if (rc->cd_new && crypt_status(rc->cd_new, rc->name_new) == CRYPT_ACTIVE)
+		crypt_deactivate(rc->cd_new, rc->name_new);
+
+	crypt_free(rc->cd_old);
+	crypt_free(rc->cd_new);
+	rc->cd_old = rc->cd_new = NULL;
+
+	crypt_safe_free(rc->vk);
+	crypt_safe_free(rc->vk_new);
+	rc->vk = rc->vk_new = NULL;
+}
+
+/*
+ * Online mode, map everything below position with the new key
+ * and next @len bytes through suspendable hotzone.
+ */
+static int switch_segments(struct reenc_ctx *rc, size_t len)
+{
+	struct crypt_params_reencrypt params = {
+		.cd_new = rc->cd_new,
+		.volume_key = rc->vk,
+		.volume_key_size = rc->vk_size,
+		.new_volume_key = rc->vk_new,
+		.new_volume_key_size = rc->vk_new_size,
+	};
+
+	return crypt_reencrypt_segments(rc->cd_old, rc->active_name, &params,
+					rc->jh.position / SECTOR_SIZE,
+					len / SECTOR_SIZE);
+}
+
+static size_t window_length(struct reenc_ctx *rc)
+{
+	if (rc->window_size > rc->jh.data_size - rc->jh.position)
+		return rc->jh.data_size - rc->jh.position;
+	return rc->window_size;
+}
+
+/*
+ * Worker threads, every thread reencrypts whole blocks from current window.
+ * Only plain I/O is done here, the library is never called from threads.
+ */
+static int reencrypt_block(struct reenc_ctx *rc, char *buf,
+			   uint64_t offset, size_t len)
+{
+	if (_pread_all(rc->old_fd, buf, len, offset) < 0)
+		return -EIO;
+
+	if (_pwrite_all(rc->new_fd, buf, len, offset) < 0)
+		return -EIO;
+
+	return 0;
+}
+
+static void *reencrypt_thread(void *arg)
+{
+	struct reenc_thread *t = arg;
+	struct reenc_ctx *rc = t->rc;
+	uint64_t offset;
+	size_t len;
+	int r;
+
+	pthread_mutex_lock(&rc->lock);
+	while (1) {
+		while (!rc->quit && rc->next >= rc->end)
+			pthread_cond_wait(&rc->cond_work, &rc->lock);
+		if (rc->quit)
+			break;
+
+		offset = rc->next;
+		len = rc->end - offset;
+		if (len > rc->block_size)
+			len = rc->block_size;
+		rc->next += len;
+		rc->busy++;
+		pthread_mutex_unlock(&rc->lock);
+
+		r = reencrypt_block(rc, t->buf, offset, len);
+
+		pthread_mutex_lock(&rc->lock);
+		if (r < 0 && !rc->error) {
+			rc->error = r;
+			rc->next = rc->end;
+		}
+		if (!--rc->busy && rc->next >= rc->end)
+			pthread_cond_signal(&rc->cond_done);
+	}
+	pthread_mutex_unlock(&rc->lock);
+
+	return NULL;
+}
+
+static int start_threads(struct reenc_ctx *rc)
+{
+	int i;
+
+	rc->threads = calloc(rc->thread_count, sizeof(*rc->threads));
+	if (!rc->threads)
+		return -ENOMEM;
+
+	for (i = 0; i < rc->thread_count; i++) {
+		rc->threads[i].rc = rc;
+		if (posix_memalign((void *)&rc->threads[i].buf, IO_ALIGN,
+				   rc->block_size))
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < rc->thread_count; i++)
+		if (pthread_create(&rc->threads[i].tid, NULL,
+				   reencrypt_thread, &rc->threads[i])) {
+			rc->thread_count = i;
+			return -ENOMEM;
+		}
+
+	log_dbg("Started %d reencryption threads, block size %zu bytes.",
+		rc->thread_count, rc->block_size);
+	return 0;
+}
+
+static void stop_threads(struct reenc_ctx *rc)
+{
+	int i;
+
+	if (!rc->threads)
+		return;
+
+	pthread_mutex_lock(&rc->lock);
+	rc->quit = 1;
+	pthread_cond_broadcast(&rc->cond_work);
+	pthread_mutex_unlock(&rc->lock);
+
+	for (i = 0; i < rc->thread_count; i++) {
+		if (rc->threads[i].tid)
+			pthread_join(rc->threads[i].tid, NULL);
+		free(rc->threads[i].buf);
+	}
+
+	free(rc->threads);
+	rc->threads = NULL;
+}
+
+static int reencrypt_window(struct reenc_ctx *rc, uint64_t offset, size_t len)
+{
+	int r;
+
+	pthread_mutex_lock(&rc->lock);
+	rc->next = offset;
+	rc->end = offset + len;
+	pthread_cond_broadcast(&rc->cond_work);
+	while (rc->busy || rc->next < rc->end)
+		pthread_cond_wait(&rc->cond_done, &rc->lock);
+	r = rc->error;
+	pthread_mutex_unlock(&rc->lock);
+
+	if (r < 0) {
+		log_err(_("IO error during reencryption.\n"));
+		return r;
+	}
+
+	if (fdatasync(rc->new_fd) < 0) {
+		log_err(_("Cannot write to device %s.\n"), rc->device);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void print_progress(struct reenc_ctx *rc, uint64_t bytes,
+			   double start, int final)
+{
+	double elapsed = _time_now() - start;
+
+	if (opt_batch_mode || !isatty(STDOUT_FILENO))
+		return;
+
+	log_std("\rProgress: %5.1f%%, %4" PRIu64 " MiB written, speed %5.1f MiB/s%s",
+		rc->jh.data_size ? 100.0 * rc->jh.position / rc->jh.data_size : 100.0,
+		bytes / MiB, elapsed > 0 ? bytes / elapsed / MiB : 0.0,
+		final ? "\n" : "");
+	fflush(stdout);
+}
+
+static int reencrypt_payload(struct reenc_ctx *rc)
+{
+	uint64_t bytes = 0;
+	double start, expected, elapsed;
+	struct timespec ts;
+	size_t len;
+	int r = 0;
+
+	log_verbose("Reencrypting %" PRIu64 " bytes, starting at offset %" PRIu64 ".\n",
+		    rc->jh.data_size, rc->jh.position);
+
+	if (posix_memalign((void *)&rc->window, IO_ALIGN, rc->window_size))
+		return -ENOMEM;
+
+	r = start_threads(rc);
+	if (r < 0)
+		return r;
+
+	if (rc->active_name && rc->jh.position < rc->jh.data_size) {
+		r = switch_segments(rc, window_length(rc));
+		if (r < 0)
+			goto out;
+	}
+
+	start = _time_now();
+	while (rc->jh.position < rc->jh.data_size) {
+		if (quit_requested) {
+			log_err(_("\nInterrupted by a signal, run again to resume reencryption.\n"));
+			r = -EINTR;
+			break;
+		}
+
+		len = window_length(rc);
+
+		if (rc->active_name) {
+			r = crypt_reencrypt_hotzone_suspend(rc->cd_old, rc->active_name);
+			if (r < 0)
+				break;
+		}
+
+		r = journal_save_window(rc, len);
+		if (r < 0)
+			break;
+
+		r = reencrypt_window(rc, rc->jh.position, len);
+		if (r < 0)
+			break;
+
+		rc->jh.state = JOURNAL_CLEAN;
+		rc->jh.position += len;
+		rc->jh.length = 0;
+		r = journal_write(rc);
+		if (r < 0)
+			break;
+
+		/*
+		 * Also resumes the hotzone, now with the new key.
+		 * The last one is resumed by the final switch.
+		 */
+		if (rc->active_name && rc->jh.position < rc->jh.data_size) {
+			r = switch_segments(rc, window_length(rc));
+			if (r < 0)
+				break;
+		}
+
+		bytes += len;
+		print_progress(rc, bytes, start, 0);
+
+		/* throttle to requested average rate */
+		if (opt_max_rate) {
+			expected = (double)bytes / ((uint64_t)opt_max_rate * MiB);
+			elapsed = _time_now() - start;
+			if (expected > elapsed) {
+				ts.tv_sec = expected - elapsed;
+				ts.tv_nsec = (expected - elapsed - ts.tv_sec) * 1000000000;
+				nanosleep(&ts, NULL);
+			}
+		}
+	}
+
+	print_progress(rc, bytes, start, 1);
+
+	/*
+	 * Failed window must not stay suspended, put the old ciphertext back
+	 * and map the same window through hotzone again.
+	 */
+	if (rc->active_name && r < 0 && r != -EINTR &&
+	    !journal_replay(rc) && !switch_segments(rc, window_length(rc)))
+		log_err(_("Device %s is still in reencryption state, run again "
+			  "to resume reencryption.\n"), rc->active_name);
+out:
+	stop_threads(rc);
+	return r;
+}
+
+static int reencrypt_finish(struct reenc_ctx *rc)
+{
+	int r;
+
+	if (rc->jh.state != JOURNAL_DONE) {
+		rc->jh.state = JOURNAL_DONE;
+		r = journal_write(rc);
+		if (r < 0)
+			return r;
+	}
+
+	r = write_new_header(rc);
+	if (r < 0)
+		return r;
+
+	close(rc->journal_fd);
+	rc->journal_fd = -1;
+	unlink(rc->journal_file);
+	unlink(rc->header_new);
+	unlink(rc->header_org);
+
+	log_std(_("Reencryption of device %s finished.\n"), rc->device);
+	return 0;
+}
+
+/* Online mode, active device must map the whole payload of @cd */
+static int check_active_device(struct reenc_ctx *rc, struct crypt_device *cd,
+			       int resume)
+{
+	struct crypt_device *cd_active = NULL;
+	struct crypt_active_device cad;
+	const char *uuid;
+	off_t dev_size;
+	int r;
+
+	/*
+	 * Device in reencryption state cannot be queried, its UUID is
+	 * checked by the library on every segment switch.
+	 */
+	if (resume && crypt_status(NULL, rc->active_name) >= CRYPT_ACTIVE) {
+		log_dbg("Device %s is in reencryption state.", rc->active_name);
+		return 0;
+	}
+
+	r = crypt_init_by_name(&cd_active, rc->active_name);
+	if (r < 0) {
+		log_err(_("Device %s is not active.\n"), rc->active_name);
+		return r;
+	}
+
+	uuid = crypt_get_uuid(cd_active);
+	if (!uuid || strcmp(uuid, crypt_get_uuid(cd))) {
+		log_err(_("Device %s is not activated from %s.\n"),
+			rc->active_name, rc->device);
+		r = -EINVAL;
+		goto out;
+	}
+
+	r = crypt_get_active_device(cd_active, rc->active_name, &cad);
+	if (r < 0)
+		goto out;
+
+	dev_size = lseek(rc->device_fd, 0, SEEK_END);
+	if (dev_size < 0 || cad.size * SECTOR_SIZE !=
+	    (uint64_t)dev_size - crypt_get_data_offset(cd) * SECTOR_SIZE) {
+		log_err(_("Device %s does not map the whole data area.\n"),
+			rc->active_name);
+		r = -EINVAL;
+	}
+out:
+	crypt_free(cd_active);
+	return r;
+}
+
+static int reencrypt(const char *device)
+{
+	struct reenc_ctx rc = {
+		.device = device,
+		.active_name = opt_active_name,
+		.device_fd = -1,
+		.journal_fd = -1,
+		.old_fd = -1,
+		.new_fd = -1,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond_work = PTHREAD_COND_INITIALIZER,
+		.cond_done = PTHREAD_COND_INITIALIZER,
+	};
+	struct crypt_device *cd = NULL;
+	struct crypt_probe_luks1 probe;
+	struct reenc_key *keys = NULL;
+	char *msg = NULL;
+	const char *uuid;
+	uint64_t data_size;
+	off_t dev_size;
+	long cpus;
+	int keyslot, resume, marked = 0, r;
+
+	rc.block_size = (size_t)opt_block_size * MiB;
+	if (opt_threads)
+		rc.thread_count = opt_threads;
+	else {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		rc.thread_count = cpus < 1 ? 1 : cpus > 8 ? 8 : cpus;
+	}
+	rc.window_size = rc.block_size * rc.thread_count;
+
+	/*
+	 * Device must not be used by anything else during offline reencryption.
+	 * Exclusive open is only a check, mappings need to claim the device.
+	 */
+	if (!rc.active_name) {
+		rc.device_fd = open(device, O_RDONLY | O_EXCL);
+		if (rc.device_fd == -1) {
+			log_err(_("Cannot exclusively open %s, device in use.\n"), device);
+			return -EBUSY;
+		}
+		close(rc.device_fd);
+	}
+
+	/* Raw device access must bypass page cache, mappings write below it */
+	rc.device_fd = open(device, O_RDWR | O_DIRECT);
+	if (rc.device_fd == -1) {
+		log_err(_("Cannot open device %s.\n"), device);
+		return -EINVAL;
+	}
+
+	if (opt_uuid)
+		uuid = opt_uuid;
+	else if (crypt_probe_luks1(device, &probe) == -EBUSY) {
+		/* Marked by online reencryption, old header is in file */
+		uuid = probe.uuid;
+		marked = 1;
+	} else {
+		if ((r = crypt_init(&cd, device)) ||
+		    (r = crypt_load(cd, CRYPT_LUKS1, NULL)))
+			goto out;
+		uuid = crypt_get_uuid(cd);
+	}
+
+	snprintf(rc.journal_file, sizeof(rc.journal_file), "LUKS-%s.log", uuid);
+	snprintf(rc.header_new, sizeof(rc.header_new), "LUKS-%s.new", uuid);
+	snprintf(rc.header_org, sizeof(rc.header_org), "LUKS-%s.org", uuid);
+
+	rc.journal_fd = open(rc.journal_file, O_RDWR);
+	resume = rc.journal_fd != -1;
+	if (resume) {
+		r = journal_read(&rc);
+		if (r < 0)
+			goto out;
+
+		if (strcmp(rc.jh.uuid, uuid)) {
+			log_err(_("Reencryption journal %s belongs to another device.\n"),
+				rc.journal_file);
+			r = -EINVAL;
+			goto out;
+		}
+
+		log_std(_("Resuming interrupted reencryption of device %s.\n"), device);
+
+		/* Payload done, only the header update is missing */
+		if (rc.jh.state == JOURNAL_DONE) {
+			r = reencrypt_finish(&rc);
+			goto out;
+		}
+	} else if (opt_uuid || marked) {
+		log_err(_("Reencryption journal %s not found.\n"), rc.journal_file);
+		r = -ENOENT;
+		goto out;
+	}
+
+	if (!cd) {
+		r = load_old_header(&rc, &cd);
+		if (r < 0)
+			goto out;
+	}
+
+	if (rc.active_name) {
+		r = check_active_device(&rc, cd, resume);
+		if (r < 0)
+			goto out;
+	}
+
+	crypt_set_timeout(cd, opt_timeout);
+	crypt_set_password_retry(cd, 1);
+
+	keys = calloc(crypt_keyslot_max(CRYPT_LUKS1), sizeof(*keys));
+	if (!keys) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	if (!resume) {
+		if (rc.active_name)
+			r = asprintf(&msg, _("Volume key and data encryption of %s "
+				     "will be changed.\nActive device %s stays "
+				     "in use during reencryption."), device,
+				     rc.active_name);
+		else
+			r = asprintf(&msg, _("Volume key and data encryption of %s "
+				     "will be changed.\nDevice must not be used "
+				     "until reencryption is finished."), device);
+		if (r == -1) {
+			r = -ENOMEM;
+			goto out;
+		}
+		r = _yesDialog(msg, NULL) ? 0 : -EPERM;
+		free(msg);
+		if (r < 0)
+			goto out;
+
+		keyslot = get_keys(cd, keys, !opt_key_file &&
+				   opt_key_slot == CRYPT_ANY_SLOT);
+		if (keyslot < 0) {
+			r = keyslot;
+			goto out;
+		}
+
+		r = create_new_header(&rc, cd, keys);
+		if (r < 0)
+			goto out;
+
+		dev_size = lseek(rc.device_fd, 0, SEEK_END);
+		data_size = crypt_get_data_offset(cd) * SECTOR_SIZE;
+		if (dev_size < 0 || (uint64_t)dev_size < data_size) {
+			log_err(_("Cannot get size of device %s.\n"), device);
+			r = -EINVAL;
+			goto out;
+		}
+		data_size = (uint64_t)dev_size - data_size;
+
+		r = journal_create(&rc, uuid, crypt_get_data_offset(cd), data_size);
+		if (r < 0)
+			goto out;
+	} else {
+		keyslot = get_keys(cd, keys, 0);
+		if (keyslot < 0) {
+			r = keyslot;
+			goto out;
+		}
+
+		if (crypt_get_data_offset(cd) != rc.jh.data_offset) {
+			log_err(_("Reencryption journal %s belongs to another device.\n"),
+				rc.journal_file);
+			r = -EINVAL;
+			goto out;
+		}
+
+		r = journal_replay(&rc);
+		if (r < 0)
+			goto out;
+	}
+
+	/*
+	 * Must be done before the first block is rewritten (and before
+	 * the active device gets the first new segment), otherwise half
+	 * reencrypted device could be opened with the old key.
+	 */
+	r = mark_header(&rc);
+	if (r < 0)
+		goto out;
+
+	crypt_free(cd);
+	cd = NULL;
+
+	r = activate_mappings(&rc, keys[keyslot].password,
+			      keys[keyslot].passwordLen, keyslot);
+	if (r < 0)
+		goto out;
+
+	r = reencrypt_payload(&rc);
+
+	/* Map whole active device with the new key, removes hotzone */
+	if (!r && rc.active_name)
+		r = switch_segments(&rc, 0);
+
+	deactivate_mappings(&rc);
+	if (r < 0)
+		goto out;
+
+	r = reencrypt_finish(&rc);
+out:
+	stop_threads(&rc);
+	deactivate_mappings(&rc);
+	crypt_free(cd);
+	if (keys)
+		free_keys(keys, crypt_keyslot_max(CRYPT_LUKS1));
+	if (rc.journal_fd != -1)
+		close(rc.journal_fd);
+	if (rc.device_fd != -1)
+		close(rc.device_fd);
+	free(rc.window);
+	return r;
+}
+
+static int run_reencrypt(const char *device)
+{
+	struct sigaction sa = { .sa_handler = _quit };
+	int r;
+
+	log_dbg("Running reencryption of %s.", device);
+
+	/* Interrupted run stops after committed window */
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	r = reencrypt(device);
+
+	/* Some functions returns keyslot # */
+	if (r > 0)
+		r = 0;
+
+	/* Translate exit code to simple codes */
+	switch (r) {
+	case 0: 	r = EXIT_SUCCESS; break;
+	case -EEXIST:
+	case -EBUSY:	r = 5; break;
+	case -ENOTBLK:
+	case -ENODEV:	r = 4; break;
+	case -ENOMEM:	r = 3; break;
+	case -EPERM:	r = 2; break;
+	case -EINVAL:
+	case -ENOENT:
+	case -ENOSYS:
+	default:	r = EXIT_FAILURE;
+	}
+	return r;
+}
+
+static void help(poptContext popt_context,
+		 enum poptCallbackReason reason __attribute__((unused)),
+		 struct poptOption *key,
+		 const char *arg __attribute__((unused)),
+		 void *data __attribute__((unused)))
+{
+	if (key->shortName == '?') {
+		log_std("%s\n",PACKAGE_STRING);
+		poptPrintHelp(popt_context, stdout, 0);
+		log_std(_("\n"
+			 "<device> is the LUKS device to reencrypt\n"
+			 "Journal and new header are stored in current directory.\n"));
+		exit(EXIT_SUCCESS);
+	} else
+		poptPrintUsage(popt_context, stdout, 0);
+	exit(EXIT_SUCCESS);
+}
+
+static void usage(poptContext popt_context, int exitcode,
+		  const char *error, const char *more)
+{
+	poptPrintUsage(popt_context, stderr, 0);
+	if (error)
+		log_err("%s: %s\n", more, error);
+	poptFreeContext(popt_context);
+	exit(exitcode);
+}
+
+int main(int argc, const char **argv)
+{
+	static struct poptOption popt_help_options[] = {
+		{ NULL,    '\0', POPT_ARG_CALLBACK, help, 0, NULL,                         NULL },
+		{ "help",  '?',  POPT_ARG_NONE,     NULL, 0, N_("Show this help message"), NULL },
+		{ "usage", '\0', POPT_ARG_NONE,     NULL, 0, N_("Display brief usage"),    NULL },
+		POPT_TABLEEND
+	};
+	static struct poptOption popt_options[] = {
+		{ NULL,                '\0', POPT_ARG_INCLUDE_TABLE, popt_help_options, 0, N_("Help options:"), NULL },
+		{ "version",           '\0', POPT_ARG_NONE, &opt_version_mode,          0, N_("Print package version"), NULL },
+		{ "verbose",           'v',  POPT_ARG_NONE, &opt_verbose,               0, N_("Shows more detailed error messages"), NULL },
+		{ "debug",             '\0', POPT_ARG_NONE, &opt_debug,                 0, N_("Show debug messages"), NULL },
+		{ "cipher",            'c',  POPT_ARG_STRING, &opt_cipher,              0, N_("The cipher used to encrypt the disk (see /proc/crypto)"), NULL },
+		{ "hash",              'h',  POPT_ARG_STRING, &opt_hash,                0, N_("The hash used to create the encryption key from the passphrase"), NULL },
+		{ "key-size",          's',  POPT_ARG_INT, &opt_key_size,               0, N_("The size of the encryption key"), N_("BITS") },
+		{ "key-file",          'd',  POPT_ARG_STRING, &opt_key_file,            0, N_("Read the key from a file."), NULL },
+		{ "keyfile-size",      'l',  POPT_ARG_LONG, &opt_keyfile_size,          0, N_("Limits the read from keyfile"), N_("bytes") },
+		{ "key-slot",          'S',  POPT_ARG_INT, &opt_key_slot,               0, N_("Use only this slot (others will be disabled)."), NULL },
+		{ "iter-time",         'i',  POPT_ARG_INT, &opt_iteration_time,         0, N_("PBKDF2 iteration time for LUKS (in ms)"), N_("msecs") },
+		{ "batch-mode",        'q',  POPT_ARG_NONE, &opt_batch_mode,            0, N_("Do not ask for confirmation"), NULL },
+		{ "timeout",           't',  POPT_ARG_INT, &opt_timeout,                0, N_("Timeout for interactive passphrase prompt (in seconds)"), N_("secs") },
+		{ "use-random",        '\0', POPT_ARG_NONE, &opt_random,                0, N_("Use /dev/random for generating volume key."), NULL },
+		{ "use-urandom",       '\0', POPT_ARG_NONE, &opt_urandom,               0, N_("Use /dev/urandom for generating volume key."), NULL },
+		{ "block-size",        'B',  POPT_ARG_INT, &opt_block_size,             0, N_("Reencryption block size"), N_("MiB") },
+		{ "threads",           '\0', POPT_ARG_INT, &opt_threads,                0, N_("Number of reencryption threads"), NULL },
+		{ "max-rate",          '\0', POPT_ARG_INT, &opt_max_rate,               0, N_("Limit reencryption throughput"), N_("MiB/s") },
+		{ "uuid",              '\0', POPT_ARG_STRING, &opt_uuid,                0, N_("UUID of device with damaged header to resume."), NULL },
+		{ "active-name",       '\0', POPT_ARG_STRING, &opt_active_name,        0, N_("Reencrypt device while it is active under this name."), N_("name") },
+		POPT_TABLEEND
+	};
+	poptContext popt_context;
+	int r;
+
+	crypt_set_log_callback(NULL, _log, NULL);
+
+	setlocale(LC_ALL, "");
+	bindtextdomain(PACKAGE, LOCALEDIR);
+	textdomain(PACKAGE);
+
+	popt_context = poptGetContext(PACKAGE, argc, argv, popt_options, 0);
+	poptSetOtherOptionHelp(popt_context,
+	                       N_("[OPTION...] <device>"));
+
+	while((r = poptGetNextOpt(popt_context)) > 0)
+		;
+
+	if (r < -1)
+		usage(popt_context, EXIT_FAILURE, poptStrerror(r),
+		      poptBadOption(popt_context, POPT_BADOPTION_NOALIAS));
+
+	if (opt_version_mode) {
+		log_std("%s %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+		poptFreeContext(popt_context);
+		exit(EXIT_SUCCESS);
+	}
+
+	action_argv = poptGetArgs(popt_context);
+	if (!action_argv || !action_argv[0] || action_argv[1])
+		usage(popt_context, EXIT_FAILURE, _("Argument <device> missing."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_keyfile_size < 0 || opt_key_size < 0 || opt_threads < 0 ||
+	    opt_max_rate < 0)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Negative number for option not permitted."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_key_size % 8)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Key size must be a multiple of 8 bits"),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_key_slot != CRYPT_ANY_SLOT &&
+	    (opt_key_slot < 0 || opt_key_slot >= crypt_keyslot_max(CRYPT_LUKS1)))
+		usage(popt_context, EXIT_FAILURE, _("Key slot is invalid."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_block_size < 1 || opt_block_size > MAX_REENCRYPT_BLOCK)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Only values between 1MiB and 64 MiB allowed for reencryption block size."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_threads > MAX_REENCRYPT_THREADS)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Too many reencryption threads requested."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_random && opt_urandom)
+		usage(popt_context, EXIT_FAILURE, _("Only one of --use-[u]random options is allowed."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_active_name && opt_uuid)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Option --uuid cannot be used with --active-name."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_debug) {
+		opt_verbose = 1;
+		crypt_set_debug_level(-1);
+		log_dbg("cryptsetup-reencrypt %s processing \"%s\"",
+			PACKAGE_VERSION, action_argv[0]);
+	}
+
+	r = run_reencrypt(action_argv[0]);
+	poptFreeContext(popt_context);
+	return r;
+}
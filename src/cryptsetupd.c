@@ -0,0 +1,655 @@
+/*
+ * cryptsetupd - long-running unlock daemon for dm-crypt devices
+ *
+ * Copyright (C) 2011, Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <libcryptsetup.h>
+#include <popt.h>
+
+#include "cryptsetup.h"
+#include "cryptsetupd.h"
+
+#define WORKERS_DEFAULT	4
+#define WORKERS_MAX	64
+#define CLIENT_TIMEOUT	30 /* seconds */
+#define RESPAWN_FAST	5  /* seconds, worker exited shortly after start */
+#define RESPAWN_TRIES	5  /* fast exits in row before giving up */
+
+static int opt_verbose = 0;
+static int opt_debug = 0;
+static int opt_version_mode = 0;
+static int opt_workers = WORKERS_DEFAULT;
+static const char *opt_socket = CRYPTSETUPD_SOCKET;
+
+static volatile sig_atomic_t quit = 0;
+
+/* Reply text collected from library messages for current request */
+static char *reply_text = NULL;
+static size_t reply_text_len = 0;
+static size_t reply_text_max = 0;
+
+__attribute__((format(printf, 5, 6)))
+static void clogger(struct crypt_device *cd, int level, const char *file,
+		   int line, const char *format, ...)
+{
+	va_list argp;
+	char *target = NULL;
+
+	va_start(argp, format);
+
+	if (vasprintf(&target, format, argp) > 0) {
+		if (level >= 0) {
+			crypt_log(cd, level, target);
+#ifdef CRYPT_DEBUG
+		} else if (opt_debug)
+			printf("# %s:%d %s\n", file ?: "?", line, target);
+#else
+		} else if (opt_debug)
+			printf("# %s\n", target);
+#endif
+	}
+
+	va_end(argp);
+	free(target);
+}
+
+static void _reply_append(const char *msg)
+{
+	size_t len = strlen(msg);
+
+	if (!reply_text || reply_text_len + len > reply_text_max)
+		return;
+
+	memcpy(&reply_text[reply_text_len], msg, len);
+	reply_text_len += len;
+}
+
+static void _log(int level, const char *msg, void *usrptr __attribute__((unused)))
+{
+	switch(level) {
+
+	case CRYPT_LOG_NORMAL:
+		_reply_append(msg);
+		break;
+	case CRYPT_LOG_VERBOSE:
+		if (opt_verbose)
+			fputs(msg, stdout);
+		break;
+	case CRYPT_LOG_ERROR:
+		_reply_append(msg);
+		fputs(msg, stderr);
+		break;
+	case CRYPT_LOG_DEBUG:
+		if (opt_debug)
+			printf("# %s\n", msg);
+		break;
+	default:
+		fprintf(stderr, "Internal error on logging class for msg: %s", msg);
+		break;
+	}
+}
+
+static void _quit(int sig __attribute__((unused)))
+{
+	quit = 1;
+}
+
+static int _handle_open(const char *device, const char *name,
+			const char *key, size_t key_len,
+			int keyslot, uint32_t flags)
+{
+	struct crypt_device *cd = NULL;
+	int r;
+
+	if (!*device || !*name)
+		return -EINVAL;
+
+	r = crypt_init(&cd, device);
+	if (r < 0)
+		goto out;
+
+	r = crypt_load(cd, CRYPT_LUKS1, NULL);
+	if (r < 0)
+		goto out;
+
+	r = crypt_activate_by_passphrase(cd, name, keyslot, key, key_len, flags);
+out:
+	crypt_free(cd);
+	return r;
+}
+
+static int _handle_close(const char *name)
+{
+	struct crypt_device *cd = NULL;
+	int r;
+
+	if (!*name)
+		return -EINVAL;
+
+	r = crypt_init_by_name(&cd, name);
+	if (r == 0)
+		r = crypt_deactivate(cd, name);
+
+	crypt_free(cd);
+	return r;
+}
+
+static int _handle_resize(const char *name, uint64_t size)
+{
+	struct crypt_device *cd = NULL;
+	int r;
+
+	if (!*name)
+		return -EINVAL;
+
+	r = crypt_init_by_name(&cd, name);
+	if (r == 0)
+		r = crypt_resize(cd, name, size);
+
+	crypt_free(cd);
+	return r;
+}
+
+static int _handle_status(const char *name)
+{
+	crypt_status_info ci;
+	struct crypt_active_device cad;
+	struct crypt_device *cd = NULL;
+	int r = 0;
+
+	if (!*name)
+		return -EINVAL;
+
+	ci = crypt_status(NULL, name);
+	switch (ci) {
+	case CRYPT_INVALID:
+		r = -EINVAL;
+		break;
+	case CRYPT_INACTIVE:
+		log_std("%s/%s is inactive.\n", crypt_get_dir(), name);
+		r = -ENODEV;
+		break;
+	case CRYPT_ACTIVE:
+	case CRYPT_BUSY:
+		log_std("%s/%s is active%s.\n", crypt_get_dir(), name,
+			ci == CRYPT_BUSY ? " and is in use" : "");
+		r = crypt_init_by_name(&cd, name);
+		if (r < 0 || !crypt_get_type(cd))
+			goto out;
+
+		log_std("  type:    %s\n", crypt_get_type(cd));
+
+		r = crypt_get_active_device(cd, name, &cad);
+		if (r < 0)
+			goto out;
+
+		log_std("  cipher:  %s-%s\n", crypt_get_cipher(cd), crypt_get_cipher_mode(cd));
+		log_std("  keysize: %d bits\n", crypt_get_volume_key_size(cd) * 8);
+		log_std("  device:  %s\n", crypt_get_device_name(cd));
+		log_std("  offset:  %" PRIu64 " sectors\n", cad.offset);
+		log_std("  size:    %" PRIu64 " sectors\n", cad.size);
+		if (cad.iv_offset)
+			log_std("  skipped: %" PRIu64 " sectors\n", cad.iv_offset);
+		log_std("  mode:    %s\n", cad.flags & CRYPT_ACTIVATE_READONLY ?
+					   "readonly" : "read/write");
+		if (cad.flags & CRYPT_ACTIVATE_ALLOW_DISCARDS)
+			log_std("  flags:   discards\n");
+	}
+out:
+	crypt_free(cd);
+	return r;
+}
+
+/*
+ * Parse and run one request. Strings are copied to NUL terminated
+ * buffers, passphrase is used in place (it lives in locked memory).
+ */
+static int _handle_request(struct cryptsetupd_request *req, size_t len)
+{
+	char *device = NULL, *name = NULL;
+	const char *key;
+	size_t data_len;
+	int r;
+
+	if (len < sizeof(*req) || req->magic != CRYPTSETUPD_MAGIC) {
+		log_err(_("Invalid request received.\n"));
+		return -EINVAL;
+	}
+
+	data_len = len - sizeof(*req);
+	if ((uint64_t)req->device_len + req->name_len + req->key_len != data_len) {
+		log_err(_("Invalid request received.\n"));
+		return -EINVAL;
+	}
+
+	device = strndup(req->data, req->device_len);
+	name = strndup(req->data + req->device_len, req->name_len);
+	key = req->data + req->device_len + req->name_len;
+	if (!device || !name) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	if (strlen(device) != req->device_len || strlen(name) != req->name_len) {
+		log_err(_("Invalid request received.\n"));
+		r = -EINVAL;
+		goto out;
+	}
+
+	switch (req->command) {
+	case CRYPTSETUPD_OPEN:
+		log_dbg("Request: open %s as %s.", device, name);
+		r = _handle_open(device, name, key, req->key_len,
+				 req->keyslot, req->flags);
+		break;
+	case CRYPTSETUPD_CLOSE:
+		log_dbg("Request: close %s.", name);
+		r = _handle_close(name);
+		break;
+	case CRYPTSETUPD_RESIZE:
+		log_dbg("Request: resize %s to %" PRIu64 " sectors.", name, req->size);
+		r = _handle_resize(name, req->size);
+		break;
+	case CRYPTSETUPD_STATUS:
+		log_dbg("Request: status %s.", name);
+		r = _handle_status(name);
+		break;
+	default:
+		log_err(_("Unknown request %u.\n"), req->command);
+		r = -EINVAL;
+	}
+out:
+	free(device);
+	free(name);
+	return r;
+}
+
+static int _check_peer(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		log_err(_("Cannot get peer credentials.\n"));
+		return -EPERM;
+	}
+
+	if (cred.uid != 0 && cred.uid != geteuid()) {
+		log_err(_("Request from pid %u (uid %u) denied.\n"),
+			(unsigned)cred.pid, (unsigned)cred.uid);
+		return -EPERM;
+	}
+
+	log_dbg("Accepted connection from pid %u (uid %u).",
+		(unsigned)cred.pid, (unsigned)cred.uid);
+	return 0;
+}
+
+static void _serve_connection(int fd, char *buf, struct cryptsetupd_reply *reply)
+{
+	struct timeval tv = { .tv_sec = CLIENT_TIMEOUT };
+	ssize_t len;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (_check_peer(fd) < 0)
+		return;
+
+	while (!quit) {
+		len = recv(fd, buf, CRYPTSETUPD_MSG_MAX, MSG_TRUNC);
+		if (len <= 0)
+			break;
+
+		reply_text = reply->text;
+		reply_text_len = 0;
+		reply_text_max = CRYPTSETUPD_MSG_MAX - sizeof(*reply);
+
+		if (len > CRYPTSETUPD_MSG_MAX) {
+			log_err(_("Request too large.\n"));
+			reply->status = -EINVAL;
+		} else
+			reply->status = _handle_request((struct cryptsetupd_request *)buf, len);
+
+		/* Passphrase must not stay in buffer */
+		memset(buf, 0, len > CRYPTSETUPD_MSG_MAX ? CRYPTSETUPD_MSG_MAX : len);
+
+		reply_text = NULL;
+		reply->magic = CRYPTSETUPD_MAGIC;
+		reply->text_len = reply_text_len;
+		reply->reserved = 0;
+
+		if (send(fd, reply, sizeof(*reply) + reply_text_len, MSG_NOSIGNAL) < 0)
+			break;
+	}
+}
+
+/*
+ * Worker keeps its state warm between requests: memory is locked once,
+ * secure buffers are allocated once and kernel capabilities are cached.
+ */
+static void _worker(int listen_fd)
+{
+	struct cryptsetupd_reply *reply;
+	uint32_t kernel_flags;
+	char *buf;
+	int fd;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	crypt_memory_lock(NULL, 1);
+
+	buf = crypt_safe_alloc(CRYPTSETUPD_MSG_MAX);
+	reply = malloc(CRYPTSETUPD_MSG_MAX);
+	if (!buf || !reply) {
+		log_err(_("Out of memory.\n"));
+		_exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * No context is kept open here, device-mapper backend is released
+	 * with the last context of every request. Only kernel capabilities
+	 * are cached for all requests.
+	 */
+	if (crypt_get_kernel_flags(&kernel_flags) < 0)
+		log_dbg("Cannot query dm-crypt kernel capabilities.");
+
+	log_dbg("Worker %u ready.", (unsigned)getpid());
+
+	while (!quit) {
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			log_err(_("Cannot accept connection: %s.\n"), strerror(errno));
+			break;
+		}
+
+		_serve_connection(fd, buf, reply);
+		close(fd);
+	}
+
+	crypt_safe_free(buf);
+	free(reply);
+	_exit(EXIT_SUCCESS);
+}
+
+static int _listen_fd_activated(void)
+{
+	const char *e;
+	char *endp;
+	long l;
+
+	e = getenv("LISTEN_PID");
+	if (!e)
+		return -ENOENT;
+
+	l = strtol(e, &endp, 10);
+	if (*endp || l != (long)getpid())
+		return -ENOENT;
+
+	e = getenv("LISTEN_FDS");
+	if (!e)
+		return -ENOENT;
+
+	l = strtol(e, &endp, 10);
+	if (*endp || l < 1)
+		return -ENOENT;
+
+	if (l > 1)
+		log_err(_("Only first of %ld passed sockets is used.\n"), l);
+
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+
+	fcntl(CRYPTSETUPD_LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+	log_dbg("Using socket passed by service manager.");
+	return CRYPTSETUPD_LISTEN_FDS_START;
+}
+
+static int _listen_fd_create(const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t old_mask;
+	int fd, r;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_err(_("Socket path %s is too long.\n"), path);
+		return -EINVAL;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		log_err(_("Cannot create socket.\n"));
+		return -errno;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+	old_mask = umask(S_IRWXG | S_IRWXO);
+	r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_mask);
+
+	if (r < 0 || listen(fd, SOMAXCONN) < 0) {
+		log_err(_("Cannot listen on socket %s: %s.\n"), path, strerror(errno));
+		close(fd);
+		return -EINVAL;
+	}
+
+	log_dbg("Listening on socket %s.", path);
+	return fd;
+}
+
+static pid_t _spawn_worker(int listen_fd)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0)
+		_worker(listen_fd);
+	else if (pid < 0)
+		log_err(_("Cannot start worker process.\n"));
+
+	return pid;
+}
+
+static int run_daemon(void)
+{
+	struct sigaction sa;
+	pid_t workers[WORKERS_MAX], pid;
+	time_t started[WORKERS_MAX];
+	int listen_fd, status, created = 0, fast_exits = 0, i, r = 0;
+
+	listen_fd = _listen_fd_activated();
+	if (listen_fd < 0) {
+		listen_fd = _listen_fd_create(opt_socket);
+		if (listen_fd < 0)
+			return listen_fd;
+		created = 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _quit;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < opt_workers; i++) {
+		workers[i] = _spawn_worker(listen_fd);
+		started[i] = time(NULL);
+	}
+
+	/*
+	 * Respawn workers which died, e.g. on allocation failure.
+	 * Worker failing right after start is respawned with growing delay,
+	 * repeated fast exits mean it cannot start at all.
+	 */
+	while (!quit && !r) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			log_err(_("No worker process is running.\n"));
+			r = -EINVAL;
+			break;
+		}
+
+		for (i = 0; i < opt_workers; i++) {
+			if (workers[i] != pid)
+				continue;
+
+			log_dbg("Worker %u exited, status %d.",
+				(unsigned)pid, status);
+			workers[i] = -1;
+
+			if (time(NULL) - started[i] >= RESPAWN_FAST)
+				fast_exits = 0;
+			else if (++fast_exits >= RESPAWN_TRIES) {
+				log_err(_("Worker process keeps failing, exiting.\n"));
+				r = -EINVAL;
+				break;
+			} else
+				sleep(fast_exits);
+
+			if (!quit) {
+				workers[i] = _spawn_worker(listen_fd);
+				started[i] = time(NULL);
+			}
+		}
+	}
+
+	for (i = 0; i < opt_workers; i++)
+		if (workers[i] > 0)
+			kill(workers[i], SIGTERM);
+	while (waitpid(-1, NULL, 0) > 0 || errno == EINTR)
+		;
+
+	close(listen_fd);
+	if (created)
+		unlink(opt_socket);
+
+	return r;
+}
+
+static void help(poptContext popt_context,
+		 enum poptCallbackReason reason __attribute__((unused)),
+		 struct poptOption *key,
+		 const char *arg __attribute__((unused)),
+		 void *data __attribute__((unused)))
+{
+	if (key->shortName == '?') {
+		log_std("%s\n",PACKAGE_STRING);
+		poptPrintHelp(popt_context, stdout, 0);
+		log_std(_("\nDefault socket: %s\n"), CRYPTSETUPD_SOCKET);
+		exit(EXIT_SUCCESS);
+	} else
+		poptPrintUsage(popt_context, stdout, 0);
+	exit(EXIT_SUCCESS);
+}
+
+static void usage(poptContext popt_context, int exitcode,
+		  const char *error, const char *more)
+{
+	poptPrintUsage(popt_context, stderr, 0);
+	if (error)
+		log_err("%s: %s\n", more, error);
+	poptFreeContext(popt_context);
+	exit(exitcode);
+}
+
+int main(int argc, const char **argv)
+{
+	static struct poptOption popt_help_options[] = {
+		{ NULL,    '\0', POPT_ARG_CALLBACK, help, 0, NULL,                         NULL },
+		{ "help",  '?',  POPT_ARG_NONE,     NULL, 0, N_("Show this help message"), NULL },
+		{ "usage", '\0', POPT_ARG_NONE,     NULL, 0, N_("Display brief usage"),    NULL },
+		POPT_TABLEEND
+	};
+	static struct poptOption popt_options[] = {
+		{ NULL,                '\0', POPT_ARG_INCLUDE_TABLE, popt_help_options, 0, N_("Help options:"), NULL },
+		{ "version",           '\0', POPT_ARG_NONE, &opt_version_mode,          0, N_("Print package version"), NULL },
+		{ "verbose",           'v',  POPT_ARG_NONE, &opt_verbose,               0, N_("Shows more detailed error messages"), NULL },
+		{ "debug",             '\0', POPT_ARG_NONE, &opt_debug,                 0, N_("Show debug messages"), NULL },
+		{ "socket",            '\0', POPT_ARG_STRING, &opt_socket,              0, N_("Path to listening socket"), NULL },
+		{ "workers",           'w',  POPT_ARG_INT, &opt_workers,                0, N_("Number of worker processes"), NULL },
+		POPT_TABLEEND
+	};
+	poptContext popt_context;
+	int r;
+
+	crypt_set_log_callback(NULL, _log, NULL);
+
+	setlocale(LC_ALL, "");
+	bindtextdomain(PACKAGE, LOCALEDIR);
+	textdomain(PACKAGE);
+
+	popt_context = poptGetContext(PACKAGE, argc, argv, popt_options, 0);
+	poptSetOtherOptionHelp(popt_context, N_("[OPTION...]"));
+
+	while((r = poptGetNextOpt(popt_context)) > 0)
+		;
+
+	if (r < -1)
+		usage(popt_context, EXIT_FAILURE, poptStrerror(r),
+		      poptBadOption(popt_context, POPT_BADOPTION_NOALIAS));
+
+	if (opt_version_mode) {
+		log_std("%s %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+		poptFreeContext(popt_context);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (poptPeekArg(popt_context))
+		usage(popt_context, EXIT_FAILURE, _("Unknown argument."),
+		      poptGetArg(popt_context));
+
+	if (opt_workers < 1 || opt_workers > WORKERS_MAX)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Number of workers is out of range.\n"),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_debug) {
+		opt_verbose = 1;
+		crypt_set_debug_level(-1);
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	}
+
+	r = run_daemon();
+
+	poptFreeContext(popt_context);
+	return r ? EXIT_FAILURE : EXIT_SUCCESS;
+}
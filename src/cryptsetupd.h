@@ -0,0 +1,65 @@
+/*
+ * cryptsetupd - unlock daemon protocol
+ *
+ * Copyright (C) 2011, Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CRYPTSETUPD_H
+#define CRYPTSETUPD_H
+
+#include <stdint.h>
+
+/*
+ * Every request and every reply is exactly one SOCK_SEQPACKET message,
+ * so no framing is needed and a connection can carry several requests.
+ * Strings in the data area are not NUL terminated, lengths are in header.
+ */
+#define CRYPTSETUPD_SOCKET	"/var/run/cryptsetupd.sock"
+#define CRYPTSETUPD_MAGIC	0x43535044 /* "CSPD" */
+#define CRYPTSETUPD_MSG_MAX	65536
+
+/* first socket passed by service manager (socket activation) */
+#define CRYPTSETUPD_LISTEN_FDS_START 3
+
+enum {
+	CRYPTSETUPD_OPEN = 1,	/* device, name, passphrase -> keyslot */
+	CRYPTSETUPD_CLOSE,	/* name */
+	CRYPTSETUPD_RESIZE,	/* name, size */
+	CRYPTSETUPD_STATUS,	/* name -> status text */
+};
+
+struct cryptsetupd_request {
+	uint32_t magic;
+	uint32_t command;
+	uint32_t flags;		/* CRYPT_ACTIVATE_* for open */
+	int32_t keyslot;	/* keyslot or CRYPT_ANY_SLOT for open */
+	uint64_t size;		/* new size in sectors for resize, 0 = whole device */
+	uint32_t device_len;
+	uint32_t name_len;
+	uint32_t key_len;
+	uint32_t reserved;
+	char data[0];		/* device, name, passphrase */
+};
+
+struct cryptsetupd_reply {
+	uint32_t magic;
+	int32_t status;		/* >= 0 on success, negative errno otherwise */
+	uint32_t text_len;
+	uint32_t reserved;
+	char text[0];		/* status output or error messages */
+};
+
+#endif /* CRYPTSETUPD_H */
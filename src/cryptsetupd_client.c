@@ -0,0 +1,395 @@
+/*
+ * cryptsetupd-client - send requests to cryptsetupd unlock daemon
+ *
+ * Copyright (C) 2011, Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <libcryptsetup.h>
+#include <popt.h>
+
+#include "cryptsetup.h"
+#include "cryptsetupd.h"
+
+static int opt_verbose = 0;
+static int opt_debug = 0;
+static int opt_version_mode = 0;
+static const char *opt_socket = CRYPTSETUPD_SOCKET;
+static const char *opt_key_file = NULL;
+static long opt_keyfile_size = 0;
+static int opt_key_slot = CRYPT_ANY_SLOT;
+static uint64_t opt_size = 0;
+static int opt_readonly = 0;
+static int opt_allow_discards = 0;
+static int opt_timeout = 0;
+
+static const char **action_argv;
+static int action_argc;
+
+static struct action_type {
+	const char *type;
+	int command;
+	int required_action_argc;
+	const char *arg_desc;
+	const char *desc;
+} action_types[] = {
+	{ "open",	CRYPTSETUPD_OPEN,	2, N_("<device> <name>"), N_("open LUKS device as mapping <name>") },
+	{ "close",	CRYPTSETUPD_CLOSE,	1, N_("<name>"), N_("remove mapping") },
+	{ "resize",	CRYPTSETUPD_RESIZE,	1, N_("<name>"), N_("resize active device") },
+	{ "status",	CRYPTSETUPD_STATUS,	1, N_("<name>"), N_("show device status") },
+	{ NULL, 0, 0, NULL, NULL }
+};
+
+__attribute__((format(printf, 5, 6)))
+static void clogger(struct crypt_device *cd, int level, const char *file,
+		   int line, const char *format, ...)
+{
+	va_list argp;
+	char *target = NULL;
+
+	va_start(argp, format);
+
+	if (vasprintf(&target, format, argp) > 0) {
+		if (level >= 0) {
+			crypt_log(cd, level, target);
+#ifdef CRYPT_DEBUG
+		} else if (opt_debug)
+			printf("# %s:%d %s\n", file ?: "?", line, target);
+#else
+		} else if (opt_debug)
+			printf("# %s\n", target);
+#endif
+	}
+
+	va_end(argp);
+	free(target);
+}
+
+static void _log(int level, const char *msg, void *usrptr __attribute__((unused)))
+{
+	switch(level) {
+
+	case CRYPT_LOG_NORMAL:
+		fputs(msg, stdout);
+		break;
+	case CRYPT_LOG_VERBOSE:
+		if (opt_verbose)
+			fputs(msg, stdout);
+		break;
+	case CRYPT_LOG_ERROR:
+		fputs(msg, stderr);
+		break;
+	case CRYPT_LOG_DEBUG:
+		if (opt_debug)
+			printf("# %s\n", msg);
+		break;
+	default:
+		fprintf(stderr, "Internal error on logging class for msg: %s", msg);
+		break;
+	}
+}
+
+static int _connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -EINVAL;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		log_err(_("Cannot connect to cryptsetupd socket %s.\n"), path);
+		close(fd);
+		return -ENOENT;
+	}
+
+	return fd;
+}
+
+static int run_action(struct action_type *action)
+{
+	struct cryptsetupd_request *req = NULL;
+	struct cryptsetupd_reply *reply = NULL;
+	const char *device = "", *name;
+	char *password = NULL;
+	size_t passwordLen = 0, req_len;
+	ssize_t len;
+	int fd = -1, r;
+
+	log_dbg("Running command %s.", action->type);
+
+	if (action->command == CRYPTSETUPD_OPEN) {
+		device = action_argv[0];
+		name = action_argv[1];
+
+		crypt_memory_lock(NULL, 1);
+		r = crypt_get_key(_("Enter passphrase: "), &password, &passwordLen,
+				  opt_keyfile_size, opt_key_file, opt_timeout, 0, NULL);
+		if (r < 0)
+			goto out;
+	} else
+		name = action_argv[0];
+
+	req_len = sizeof(*req) + strlen(device) + strlen(name) + passwordLen;
+	if (req_len > CRYPTSETUPD_MSG_MAX) {
+		log_err(_("Request exceeds maximal size %d.\n"), CRYPTSETUPD_MSG_MAX);
+		r = -EINVAL;
+		goto out;
+	}
+
+	req = crypt_safe_alloc(req_len);
+	reply = malloc(CRYPTSETUPD_MSG_MAX + 1);
+	if (!req || !reply) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	req->magic = CRYPTSETUPD_MAGIC;
+	req->command = action->command;
+	req->keyslot = opt_key_slot;
+	req->size = opt_size;
+	req->flags = 0;
+	if (opt_readonly)
+		req->flags |= CRYPT_ACTIVATE_READONLY;
+	if (opt_allow_discards)
+		req->flags |= CRYPT_ACTIVATE_ALLOW_DISCARDS;
+	req->device_len = strlen(device);
+	req->name_len = strlen(name);
+	req->key_len = passwordLen;
+	memcpy(req->data, device, req->device_len);
+	memcpy(req->data + req->device_len, name, req->name_len);
+	if (passwordLen)
+		memcpy(req->data + req->device_len + req->name_len,
+		       password, passwordLen);
+
+	fd = _connect(opt_socket);
+	if (fd < 0) {
+		r = fd;
+		goto out;
+	}
+
+	if (send(fd, req, req_len, MSG_NOSIGNAL) != (ssize_t)req_len) {
+		log_err(_("Cannot send request to cryptsetupd.\n"));
+		r = -EIO;
+		goto out;
+	}
+
+	len = recv(fd, reply, CRYPTSETUPD_MSG_MAX, 0);
+	if (len < (ssize_t)sizeof(*reply) || reply->magic != CRYPTSETUPD_MAGIC ||
+	    reply->text_len != len - sizeof(*reply)) {
+		log_err(_("Invalid reply from cryptsetupd.\n"));
+		r = -EIO;
+		goto out;
+	}
+
+	reply->text[reply->text_len] = '\0';
+	r = reply->status;
+	if (r < 0)
+		log_err("%s", reply->text);
+	else
+		log_std("%s", reply->text);
+out:
+	if (fd >= 0)
+		close(fd);
+	crypt_safe_free(password);
+	crypt_safe_free(req);
+	free(reply);
+	crypt_memory_lock(NULL, 0);
+
+	/* Some functions returns keyslot # */
+	if (r > 0)
+		r = 0;
+
+	/* Translate exit code to simple codes */
+	switch (r) {
+	case 0: 	r = EXIT_SUCCESS; break;
+	case -EEXIST:
+	case -EBUSY:	r = 5; break;
+	case -ENOTBLK:
+	case -ENODEV:	r = 4; break;
+	case -ENOMEM:	r = 3; break;
+	case -EPERM:	r = 2; break;
+	case -EINVAL:
+	case -ENOENT:
+	case -ENOSYS:
+	default:	r = EXIT_FAILURE;
+	}
+	return r;
+}
+
+static void help(poptContext popt_context,
+		 enum poptCallbackReason reason __attribute__((unused)),
+		 struct poptOption *key,
+		 const char *arg __attribute__((unused)),
+		 void *data __attribute__((unused)))
+{
+	if (key->shortName == '?') {
+		struct action_type *action;
+
+		log_std("%s\n",PACKAGE_STRING);
+
+		poptPrintHelp(popt_context, stdout, 0);
+
+		log_std(_("\n"
+			 "<action> is one of:\n"));
+
+		for(action = action_types; action->type; action++)
+			log_std("\t%s %s - %s\n", action->type, _(action->arg_desc), _(action->desc));
+
+		log_std(_("\nDefault socket: %s\n"), CRYPTSETUPD_SOCKET);
+		exit(EXIT_SUCCESS);
+	} else
+		poptPrintUsage(popt_context, stdout, 0);
+	exit(EXIT_SUCCESS);
+}
+
+static void usage(poptContext popt_context, int exitcode,
+		  const char *error, const char *more)
+{
+	poptPrintUsage(popt_context, stderr, 0);
+	if (error)
+		log_err("%s: %s\n", more, error);
+	poptFreeContext(popt_context);
+	exit(exitcode);
+}
+
+int main(int argc, const char **argv)
+{
+	static char *popt_tmp;
+	static struct poptOption popt_help_options[] = {
+		{ NULL,    '\0', POPT_ARG_CALLBACK, help, 0, NULL,                         NULL },
+		{ "help",  '?',  POPT_ARG_NONE,     NULL, 0, N_("Show this help message"), NULL },
+		{ "usage", '\0', POPT_ARG_NONE,     NULL, 0, N_("Display brief usage"),    NULL },
+		POPT_TABLEEND
+	};
+	static struct poptOption popt_options[] = {
+		{ NULL,                '\0', POPT_ARG_INCLUDE_TABLE, popt_help_options, 0, N_("Help options:"), NULL },
+		{ "version",           '\0', POPT_ARG_NONE, &opt_version_mode,          0, N_("Print package version"), NULL },
+		{ "verbose",           'v',  POPT_ARG_NONE, &opt_verbose,               0, N_("Shows more detailed error messages"), NULL },
+		{ "debug",             '\0', POPT_ARG_NONE, &opt_debug,                 0, N_("Show debug messages"), NULL },
+		{ "socket",            '\0', POPT_ARG_STRING, &opt_socket,              0, N_("Path to cryptsetupd socket"), NULL },
+		{ "key-file",          'd',  POPT_ARG_STRING, &opt_key_file,            0, N_("Read the key from a file."), NULL },
+		{ "keyfile-size",      'l',  POPT_ARG_LONG, &opt_keyfile_size,          0, N_("Limits the read from keyfile"), N_("bytes") },
+		{ "key-slot",          'S',  POPT_ARG_INT, &opt_key_slot,               0, N_("Slot number to unlock (default is any)"), NULL },
+		{ "size",              'b',  POPT_ARG_STRING, &popt_tmp,                1, N_("The size of the device"), N_("SECTORS") },
+		{ "readonly",          'r',  POPT_ARG_NONE, &opt_readonly,              0, N_("Create a readonly mapping"), NULL },
+		{ "allow-discards",    '\0', POPT_ARG_NONE, &opt_allow_discards,        0, N_("Allow discards (aka TRIM) requests for device."), NULL },
+		{ "timeout",           't',  POPT_ARG_INT, &opt_timeout,                0, N_("Timeout for interactive passphrase prompt (in seconds)"), N_("secs") },
+		POPT_TABLEEND
+	};
+	const char *null_action_argv[] = {NULL};
+	poptContext popt_context;
+	struct action_type *action;
+	const char *aname;
+	int r;
+
+	crypt_set_log_callback(NULL, _log, NULL);
+
+	setlocale(LC_ALL, "");
+	bindtextdomain(PACKAGE, LOCALEDIR);
+	textdomain(PACKAGE);
+
+	popt_context = poptGetContext(PACKAGE, argc, argv, popt_options, 0);
+	poptSetOtherOptionHelp(popt_context,
+	                       N_("[OPTION...] <action> <action-specific>]"));
+
+	while((r = poptGetNextOpt(popt_context)) > 0) {
+		unsigned long long ull_value;
+		char *endp;
+
+		ull_value = strtoull(popt_tmp, &endp, 0);
+		if (*endp || !*popt_tmp)
+			r = POPT_ERROR_BADNUMBER;
+
+		switch(r) {
+			case 1:
+				opt_size = ull_value;
+				break;
+		}
+
+		if (r < 0)
+			break;
+	}
+
+	if (r < -1)
+		usage(popt_context, EXIT_FAILURE, poptStrerror(r),
+		      poptBadOption(popt_context, POPT_BADOPTION_NOALIAS));
+
+	if (opt_version_mode) {
+		log_std("%s %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+		poptFreeContext(popt_context);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (!(aname = poptGetArg(popt_context)))
+		usage(popt_context, EXIT_FAILURE, _("Argument <action> missing."),
+		      poptGetInvocationName(popt_context));
+	for(action = action_types; action->type; action++)
+		if (strcmp(action->type, aname) == 0)
+			break;
+	if (!action->type)
+		usage(popt_context, EXIT_FAILURE, _("Unknown action."),
+		      poptGetInvocationName(popt_context));
+
+	action_argc = 0;
+	action_argv = poptGetArgs(popt_context);
+	/* Make return values of poptGetArgs more consistent in case of remaining argc = 0 */
+	if(!action_argv)
+		action_argv = null_action_argv;
+
+	/* Count args, somewhat unnice, change? */
+	while(action_argv[action_argc] != NULL)
+		action_argc++;
+
+	if (action_argc < action->required_action_argc) {
+		char buf[128];
+		snprintf(buf, 128,_("%s: requires %s as arguments"), action->type, action->arg_desc);
+		usage(popt_context, EXIT_FAILURE, buf,
+		      poptGetInvocationName(popt_context));
+	}
+
+	if (opt_keyfile_size < 0)
+		usage(popt_context, EXIT_FAILURE,
+		      _("Negative number for option not permitted."),
+		      poptGetInvocationName(popt_context));
+
+	if (opt_debug) {
+		opt_verbose = 1;
+		crypt_set_debug_level(-1);
+		log_dbg("cryptsetupd-client %s processing \"%s\"", PACKAGE_VERSION, aname);
+	}
+
+	r = run_action(action);
+	poptFreeContext(popt_context);
+	return r;
+}
@@ -0,0 +1,420 @@
+/*
+ * cryptsetup library API latency benchmark
+ *
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "libcryptsetup.h"
+#include "utils_loop.h"
+
+#define IMAGE_BENCH "bench.img"
+#define IMAGE_SIZE_MB 16
+#define HEADER_BACKUP "bench-header.bak"
+#define CDEVICE_BENCH "cbench"
+
+/* activation is measured for keyslots 0 .. BENCH_SLOTS - 1 */
+#define BENCH_SLOTS 7
+#define BENCH_ADD_SLOT 7
+
+#define DEFAULT_RUNS 20
+#define DEFAULT_ITER_MS 10
+
+static int _debug = 0;
+static int _runs = DEFAULT_RUNS;
+static int _iter_ms = DEFAULT_ITER_MS;
+static const char *_json_file = NULL;
+
+static char *DEVICE_1 = NULL;
+
+struct bench_result {
+	char name[64];
+	int count;
+	int size;
+	double *ms;
+};
+
+static struct bench_result results[32];
+static int results_count = 0;
+
+// Helpers
+
+static double _time_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void _passphrase(int slot, char *buf, size_t size)
+{
+	snprintf(buf, size, "bench-passphrase-%d", slot);
+}
+
+static void _system(const char *command, int warn)
+{
+	if (system(command) < 0 && warn)
+		printf("System command failed: %s", command);
+}
+
+static void _cleanup(void)
+{
+	if (crypt_status(NULL, CDEVICE_BENCH) >= CRYPT_ACTIVE)
+		crypt_deactivate(NULL, CDEVICE_BENCH);
+
+	if (DEVICE_1 && crypt_loop_device(DEVICE_1))
+		crypt_loop_detach(DEVICE_1);
+
+	_system("rm -f " IMAGE_BENCH " " HEADER_BACKUP, 0);
+}
+
+static int _setup(void)
+{
+	int fd, ro = 0;
+
+	/* Sparse file, only LUKS header is ever written */
+	fd = open(IMAGE_BENCH, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if (fd == -1 || ftruncate(fd, IMAGE_SIZE_MB * 1024 * 1024) < 0) {
+		printf("Cannot create image file.\n");
+		if (fd != -1)
+			close(fd);
+		return 1;
+	}
+	close(fd);
+
+	DEVICE_1 = crypt_loop_get_device();
+	if (!DEVICE_1) {
+		printf("Cannot find free loop device.\n");
+		return 1;
+	}
+
+	fd = crypt_loop_attach(DEVICE_1, IMAGE_BENCH, 0, 0, &ro);
+	if (fd < 0) {
+		printf("Cannot attach loop device.\n");
+		return 1;
+	}
+	close(fd);
+
+	return 0;
+}
+
+static struct bench_result *_result(const char *name)
+{
+	struct bench_result *br;
+	int i;
+
+	for (i = 0; i < results_count; i++)
+		if (!strcmp(results[i].name, name))
+			return &results[i];
+
+	if (results_count == sizeof(results) / sizeof(*results))
+		return NULL;
+
+	br = &results[results_count++];
+	strncpy(br->name, name, sizeof(br->name) - 1);
+
+	return br;
+}
+
+static void _record(const char *name, double start)
+{
+	struct bench_result *br = _result(name);
+	double ms = _time_ms() - start, *tmp;
+
+	if (!br)
+		return;
+
+	if (br->count == br->size) {
+		tmp = realloc(br->ms, (br->size + _runs) * sizeof(*br->ms));
+		if (!tmp)
+			return;
+		br->ms = tmp;
+		br->size += _runs;
+	}
+
+	br->ms[br->count++] = ms;
+}
+
+static void check_ok(int status, int line, const char *func)
+{
+	char buf[256];
+
+	if (status < 0) {
+		crypt_get_error(buf, sizeof(buf));
+		printf("FAIL line %d [%s]: code %d, %s\n", line, func, status, buf);
+		_cleanup();
+		exit(-1);
+	}
+}
+
+#define OK_(x)	do { check_ok((x), __LINE__, __FUNCTION__); } while(0)
+
+/* Time one call of x, recorded under name */
+#define TIME_(name, x) do { double __start = _time_ms(); \
+			    int __r = (x); \
+			    _record((name), __start); \
+			    check_ok(__r, __LINE__, __FUNCTION__); \
+			  } while(0)
+
+// Statistics
+
+static int _cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest-rank percentile of sorted values */
+static double _percentile(double *ms, int count, int p)
+{
+	int rank = (p * count + 99) / 100;
+
+	if (rank < 1)
+		rank = 1;
+	return ms[rank - 1];
+}
+
+static double _mean(double *ms, int count)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		sum += ms[i];
+
+	return count ? sum / count : 0;
+}
+
+static void print_results(void)
+{
+	struct bench_result *br;
+	int i;
+
+	printf("%-24s %5s %9s %9s %9s %9s %9s %9s\n", "operation", "runs",
+	       "min", "p50", "p90", "p99", "max", "mean");
+
+	for (i = 0; i < results_count; i++) {
+		br = &results[i];
+		qsort(br->ms, br->count, sizeof(*br->ms), _cmp_double);
+		printf("%-24s %5d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+		       br->name, br->count, br->ms[0],
+		       _percentile(br->ms, br->count, 50),
+		       _percentile(br->ms, br->count, 90),
+		       _percentile(br->ms, br->count, 99),
+		       br->ms[br->count - 1], _mean(br->ms, br->count));
+	}
+}
+
+/* Results must be already sorted by print_results() */
+static int write_json(const char *file)
+{
+	struct bench_result *br;
+	FILE *f;
+	int i;
+
+	f = fopen(file, "w");
+	if (!f) {
+		printf("Cannot write results to %s.\n", file);
+		return 1;
+	}
+
+	fprintf(f, "{\n  \"runs\": %d,\n  \"iter_time_ms\": %d,\n", _runs, _iter_ms);
+	fprintf(f, "  \"unit\": \"ms\",\n  \"results\": [\n");
+
+	for (i = 0; i < results_count; i++) {
+		br = &results[i];
+		fprintf(f, "    { \"name\": \"%s\", \"runs\": %d, "
+			"\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+			"\"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f }%s\n",
+			br->name, br->count, br->ms[0],
+			_percentile(br->ms, br->count, 50),
+			_percentile(br->ms, br->count, 90),
+			_percentile(br->ms, br->count, 99),
+			br->ms[br->count - 1], _mean(br->ms, br->count),
+			i + 1 < results_count ? "," : "");
+	}
+
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+	return 0;
+}
+
+// Benchmarks
+
+static void FormatDevice(void)
+{
+	struct crypt_device *cd;
+	struct crypt_params_luks1 params = {
+		.hash = "sha1",
+		.data_alignment = 2048,
+	};
+	char pass[64];
+	int i;
+
+	OK_(crypt_init(&cd, DEVICE_1));
+	crypt_set_iterarion_time(cd, _iter_ms);
+	OK_(crypt_format(cd, CRYPT_LUKS1, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+
+	for (i = 0; i < BENCH_SLOTS; i++) {
+		_passphrase(i, pass, sizeof(pass));
+		OK_(crypt_keyslot_add_by_volume_key(cd, i, NULL, 0, pass, strlen(pass)));
+	}
+
+	crypt_free(cd);
+}
+
+static void InitLoad(void)
+{
+	struct crypt_device *cd;
+	int i;
+
+	for (i = 0; i < _runs; i++) {
+		TIME_("crypt_init", crypt_init(&cd, DEVICE_1));
+		TIME_("crypt_load", crypt_load(cd, CRYPT_LUKS1, NULL));
+		crypt_free(cd);
+	}
+}
+
+/* CRYPT_ANY_SLOT tries keyslots in order, so cost grows with position */
+static void ActivateBySlot(void)
+{
+	struct crypt_device *cd;
+	char pass[64], name[64];
+	int i, slot;
+
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+
+	for (slot = 0; slot < BENCH_SLOTS; slot++) {
+		_passphrase(slot, pass, sizeof(pass));
+		snprintf(name, sizeof(name), "activate_slot%d", slot);
+		for (i = 0; i < _runs; i++) {
+			TIME_(name, crypt_activate_by_passphrase(cd, CDEVICE_BENCH,
+				CRYPT_ANY_SLOT, pass, strlen(pass), 0));
+			TIME_("crypt_deactivate", crypt_deactivate(cd, CDEVICE_BENCH));
+		}
+	}
+
+	crypt_free(cd);
+}
+
+static void KeyslotAddDestroy(void)
+{
+	struct crypt_device *cd;
+	char pass[64], new_pass[64];
+	int i;
+
+	_passphrase(0, pass, sizeof(pass));
+	_passphrase(BENCH_ADD_SLOT, new_pass, sizeof(new_pass));
+
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+	crypt_set_iterarion_time(cd, _iter_ms);
+
+	for (i = 0; i < _runs; i++) {
+		TIME_("crypt_keyslot_add", crypt_keyslot_add_by_passphrase(cd,
+			BENCH_ADD_SLOT, pass, strlen(pass), new_pass, strlen(new_pass)));
+		TIME_("crypt_keyslot_destroy", crypt_keyslot_destroy(cd, BENCH_ADD_SLOT));
+	}
+
+	crypt_free(cd);
+}
+
+static void HeaderBackupRestore(void)
+{
+	struct crypt_device *cd;
+	int i;
+
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+
+	for (i = 0; i < _runs; i++) {
+		unlink(HEADER_BACKUP);
+		TIME_("crypt_header_backup", crypt_header_backup(cd, CRYPT_LUKS1, HEADER_BACKUP));
+		TIME_("crypt_header_restore", crypt_header_restore(cd, CRYPT_LUKS1, HEADER_BACKUP));
+	}
+
+	crypt_free(cd);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [--runs N] [--iter-time MS] [--json FILE] [--debug]\n", prog);
+	exit(1);
+}
+
+int main (int argc, char *argv[])
+{
+	int i, r = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp("--debug", argv[i]))
+			_debug = 1;
+		else if (!strcmp("--runs", argv[i]) && i + 1 < argc)
+			_runs = atoi(argv[++i]);
+		else if (!strcmp("--iter-time", argv[i]) && i + 1 < argc)
+			_iter_ms = atoi(argv[++i]);
+		else if (!strcmp("--json", argv[i]) && i + 1 < argc)
+			_json_file = argv[++i];
+		else
+			usage(argv[0]);
+	}
+
+	if (_runs < 1 || _iter_ms < 1)
+		usage(argv[0]);
+
+	if (getuid() != 0) {
+		printf("You must be root to run this benchmark.\n");
+		exit(0);
+	}
+
+	crypt_set_debug_level(_debug ? CRYPT_DEBUG_ALL : CRYPT_DEBUG_NONE);
+
+	_cleanup();
+	if (_setup()) {
+		r = 1;
+		goto out;
+	}
+
+	printf("Running %d iterations (PBKDF2 iteration time %d ms) on %s.\n",
+	       _runs, _iter_ms, DEVICE_1);
+
+	FormatDevice();
+	InitLoad();
+	ActivateBySlot();
+	KeyslotAddDestroy();
+	HeaderBackupRestore();
+
+	print_results();
+	if (_json_file)
+		r = write_json(_json_file);
+out:
+	_cleanup();
+	for (i = 0; i < results_count; i++)
+		free(results[i].ms);
+	return r;
+}
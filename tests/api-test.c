@@ -730,19 +730,47 @@ static void CallbacksTest(void)
 	crypt_free(cd);
 }
 
+static int timing_pbkdf2_keyslot = -1;
+static void timing_callback(const struct crypt_timing *t, void *usrptr)
+{
+	int *phases = usrptr;
+
+	assert(t);
+	assert(t->phase);
+	(*phases)++;
+
+	if (!strcmp(t->phase, "pbkdf2"))
+		timing_pbkdf2_keyslot = t->keyslot;
+}
+
 static void UseLuksDevice(void)
 {
 	struct crypt_device *cd;
 	char key[128];
 	size_t key_size;
+	struct crypt_active_entry *list;
+	int phases = 0, i, count;
 
 	OK_(crypt_init(&cd, DEVICE_1));
+	crypt_set_timing_callback(cd, timing_callback, &phases);
 	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+	EQ_(phases, 1);
 	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_INACTIVE);
 	OK_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, KEY1, strlen(KEY1), 0));
+	EQ_(timing_pbkdf2_keyslot, 0);
+	crypt_set_timing_callback(cd, NULL, NULL);
 	OK_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, KEY1, strlen(KEY1), 0));
 	FAIL_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, KEY1, strlen(KEY1), 0), "already open");
 	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+
+	count = crypt_list_active(&list);
+	for (i = 0; i < count && strcmp(list[i].name, CDEVICE_1); i++);
+	EQ_(i < count, 1);
+	OK_(strcmp(list[i].type, CRYPT_LUKS1));
+	EQ_(list[i].offset, 1032);
+	EQ_(list[i].flags & CRYPT_ACTIVATE_READONLY, 0);
+	crypt_free_active_list(list, count);
+
 	OK_(crypt_deactivate(cd, CDEVICE_1));
 	FAIL_(crypt_deactivate(cd, CDEVICE_1), "no such device");
 
@@ -766,6 +794,77 @@ static void UseLuksDevice(void)
 	crypt_free(cd);
 }
 
+static void ProbeLuksDevice(void)
+{
+	struct crypt_probe_luks1 probe;
+
+	FAIL_(crypt_probe_luks1(DEVICE_EMPTY, &probe), "no LUKS header");
+	FAIL_(crypt_probe_luks1(DEVICE_ERROR, &probe), "read error");
+	FAIL_(crypt_probe_luks1(IMAGE_EMPTY "blah", &probe), "no such file");
+
+	OK_(crypt_probe_luks1(DEVICE_1, NULL));
+	OK_(crypt_probe_luks1(DEVICE_1, &probe));
+	OK_(strcmp(DEVICE_1_UUID, probe.uuid));
+	OK_(strcmp("aes", probe.cipher));
+	OK_(strcmp("cbc-essiv:sha256", probe.cipher_mode));
+	OK_(strcmp("sha1", probe.hash));
+	EQ_(16, probe.volume_key_size);
+	EQ_(1032, probe.data_offset);
+}
+
+static void ReencryptionState(void)
+{
+	struct crypt_probe_luks1 probe;
+	struct crypt_device *cd;
+	char tmp[512];
+
+	// Multi-segment table of online reencryption, only status is allowed
+	snprintf(tmp, sizeof(tmp), "printf '"
+		"0 100 crypt aes-cbc-essiv:sha256 deadbabedeadbabedeadbabedeadbabe 0 %s 1032\\n"
+		"100 100 linear %s 1132\\n' | dmsetup create %s "
+		"-u CRYPT-LUKS1-286322748c8a493f835bda802e1c576b-%s",
+		DEVICE_1, DEVICE_1, CDEVICE_1, CDEVICE_1);
+	_system(tmp, 1);
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	EQ_(crypt_resize(cd, CDEVICE_1, 50), -EBUSY);
+	EQ_(crypt_suspend(cd, CDEVICE_1), -EBUSY);
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	crypt_free(cd);
+	FAIL_(crypt_init_by_name(&cd, CDEVICE_1), "reencryption table");
+	_system("dmsetup remove " CDEVICE_1, 0);
+
+	// Header marked by interrupted online reencryption
+	snprintf(tmp, sizeof(tmp), "printf 'SKUL' | dd of=%s conv=notrunc 2>/dev/null", DEVICE_1);
+	_system(tmp, 1);
+	EQ_(crypt_probe_luks1(DEVICE_1, &probe), -EBUSY);
+	OK_(strcmp(DEVICE_1_UUID, probe.uuid));
+	OK_(crypt_init(&cd, DEVICE_1));
+	EQ_(crypt_load(cd, CRYPT_LUKS1, NULL), -EBUSY);
+	crypt_free(cd);
+
+	snprintf(tmp, sizeof(tmp), "printf 'LUKS' | dd of=%s conv=notrunc 2>/dev/null", DEVICE_1);
+	_system(tmp, 1);
+	OK_(crypt_probe_luks1(DEVICE_1, NULL));
+}
+
+static void KernelFlags(void)
+{
+	uint32_t flags, flags_cached;
+
+	FAIL_(crypt_get_kernel_flags(NULL), "no output");
+
+	/* dm-crypt is loaded by previous tests */
+	OK_(crypt_get_kernel_flags(&flags));
+	OK_(crypt_get_kernel_flags(&flags_cached));
+	EQ_(flags, flags_cached);
+
+	crypt_invalidate_kernel_flags();
+	OK_(crypt_get_kernel_flags(&flags_cached));
+	EQ_(flags, flags_cached);
+}
+
 static void SuspendDevice(void)
 {
 	int suspend_status;
@@ -1109,6 +1208,9 @@ int main (int argc, char *argv[])
 	RUN_(HashDevicePlain, "plain device API hash test");
 	RUN_(AddDeviceLuks, "Format and use LUKS device");
 	RUN_(UseLuksDevice, "Use pre-formated LUKS device");
+	RUN_(ProbeLuksDevice, "Probe pre-formated LUKS device");
+	RUN_(ReencryptionState, "Device in online reencryption state");
+	RUN_(KernelFlags, "Cached kernel dm-crypt flags");
 	RUN_(SuspendDevice, "Suspend/Resume test");
 	RUN_(UseTempVolumes, "Format and use temporary encrypted device");
 
@@ -0,0 +1,358 @@
+/*
+ * cryptsetup crypto backend micro-benchmark
+ *
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Linked directly with the internal crypto backend and LUKS AF/PBKDF2 code
+ * of one build. Configure with each --with-crypto_backend and compare
+ * the JSON results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "crypto_backend.h"
+#include "af.h"
+#include "pbkdf.h"
+
+#ifndef CRYPTO_BACKEND
+#define CRYPTO_BACKEND "unknown"
+#endif
+
+#define DEFAULT_BENCH_MS 200
+
+static int _debug = 0;
+static int _bench_ms = DEFAULT_BENCH_MS;
+static const char *_json_file = NULL;
+static FILE *_json = NULL;
+static int _json_items = 0;
+
+static const char *hashes[] = {
+	"sha1", "sha256", "sha512", "ripemd160", "whirlpool", NULL
+};
+
+#define MAX_MSG_SIZE 65536
+static const size_t msg_sizes[] = { 16, 64, 256, 1024, 4096, MAX_MSG_SIZE, 0 };
+
+static const unsigned int af_stripes[] = { 1, 10, 100, 1000, 4000, 0 };
+
+#define AF_KEY_SIZE 32
+
+// Library internals used by the backend code
+
+void logger(struct crypt_device *cd __attribute__((unused)), int class,
+	    const char *file, int line, const char *format, ...)
+{
+	va_list argp;
+
+	if (class == CRYPT_LOG_DEBUG && !_debug)
+		return;
+
+	va_start(argp, format);
+	printf("# %s:%d ", file, line);
+	vprintf(format, argp);
+	printf("\n");
+	va_end(argp);
+}
+
+/* Only AF_split needs random data, quality does not matter here */
+int crypt_random_get(struct crypt_device *ctx __attribute__((unused)),
+		     char *buf, size_t len,
+		     int quality __attribute__((unused)))
+{
+	static int fd = -1;
+	ssize_t r;
+
+	if (fd == -1)
+		fd = open("/dev/urandom", O_RDONLY);
+	if (fd == -1)
+		return -EINVAL;
+
+	while (len) {
+		r = read(fd, buf, len);
+		if (r <= 0)
+			return -EINVAL;
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+// Helpers
+
+static double _time_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* size is message size or AF stripes, bytes are processed per operation */
+static void _result(const char *test, const char *alg, size_t size,
+		    size_t bytes, unsigned long ops, double ms)
+{
+	double us_op = ms * 1000.0 / ops;
+	double mbs = (double)bytes * ops / (1024 * 1024) / (ms / 1000.0);
+
+	printf("%-14s %-10s %6zu %10lu %12.3f %10.1f\n",
+	       test, alg, size, ops, us_op, mbs);
+
+	if (!_json)
+		return;
+
+	fprintf(_json, "%s    { \"test\": \"%s\", \"alg\": \"%s\", \"size\": %zu, "
+		"\"ops\": %lu, \"us_per_op\": %.3f, \"mib_per_s\": %.1f }",
+		_json_items++ ? ",\n" : "", test, alg, size, ops, us_op, mbs);
+}
+
+static void _failed(const char *test, const char *alg, int r)
+{
+	printf("%-14s %-10s %6s %10s %12s %10s (error %d)\n",
+	       test, alg, "-", "N/A", "N/A", "N/A", r);
+}
+
+/* Repeat one operation for at least _bench_ms */
+#define BENCH_LOOP(ops, ms, r, x) do { \
+		double __start = _time_ms(); \
+		(ops) = 0; \
+		do { \
+			if (((r) = (x)) < 0) \
+				break; \
+			(ops)++; \
+			(ms) = _time_ms() - __start; \
+		} while ((ms) < _bench_ms); \
+	} while (0)
+
+// Benchmarks
+
+static int hash_one(const char *name, const char *buf, size_t size)
+{
+	struct crypt_hash *h;
+	char out[64];
+	int r;
+
+	r = crypt_hash_init(&h, name);
+	if (r < 0)
+		return r;
+
+	if (size)
+		r = crypt_hash_write(h, buf, size);
+	if (!r)
+		r = crypt_hash_final(h, out, crypt_hash_size(name));
+
+	crypt_hash_destroy(h);
+	return r;
+}
+
+static int hmac_one(const char *name, const char *buf, size_t size)
+{
+	struct crypt_hmac *h;
+	char out[64], key[32] = { 0 };
+	int r;
+
+	r = crypt_hmac_init(&h, name, key, sizeof(key));
+	if (r < 0)
+		return r;
+
+	if (size)
+		r = crypt_hmac_write(h, buf, size);
+	if (!r)
+		r = crypt_hmac_final(h, out, crypt_hmac_size(name));
+
+	crypt_hmac_destroy(h);
+	return r;
+}
+
+static int init_destroy_one(const char *name)
+{
+	struct crypt_hash *h;
+	int r;
+
+	r = crypt_hash_init(&h, name);
+	if (!r)
+		crypt_hash_destroy(h);
+
+	return r;
+}
+
+static void HashBench(char *buf)
+{
+	unsigned long ops;
+	double ms = 0;
+	int i, j, r;
+
+	for (i = 0; hashes[i]; i++) {
+		BENCH_LOOP(ops, ms, r, init_destroy_one(hashes[i]));
+		if (r < 0) {
+			_failed("hash", hashes[i], r);
+			continue;
+		}
+		_result("hash_init", hashes[i], 0, 0, ops, ms);
+
+		for (j = 0; msg_sizes[j]; j++) {
+			BENCH_LOOP(ops, ms, r, hash_one(hashes[i], buf, msg_sizes[j]));
+			if (r < 0)
+				_failed("hash", hashes[i], r);
+			else
+				_result("hash", hashes[i], msg_sizes[j],
+					msg_sizes[j], ops, ms);
+		}
+	}
+}
+
+static void HmacBench(char *buf)
+{
+	unsigned long ops;
+	double ms = 0;
+	int i, j, r;
+
+	for (i = 0; hashes[i]; i++)
+		for (j = 0; msg_sizes[j]; j++) {
+			BENCH_LOOP(ops, ms, r, hmac_one(hashes[i], buf, msg_sizes[j]));
+			if (r < 0) {
+				_failed("hmac", hashes[i], r);
+				break;
+			}
+			_result("hmac", hashes[i], msg_sizes[j],
+				msg_sizes[j], ops, ms);
+		}
+}
+
+static void Pbkdf2Bench(void)
+{
+	uint64_t iterations;
+	int i, r;
+
+	for (i = 0; hashes[i]; i++) {
+		r = PBKDF2_performance_check(hashes[i], &iterations);
+		if (r < 0) {
+			_failed("pbkdf2", hashes[i], r);
+			continue;
+		}
+		/* measured for one second of CPU time */
+		_result("pbkdf2", hashes[i], 0, 0, iterations, 1000.0);
+	}
+}
+
+static void AfBench(void)
+{
+	char key[AF_KEY_SIZE], *split;
+	unsigned long ops;
+	double ms = 0;
+	int i, r;
+
+	memset(key, 0x55, sizeof(key));
+
+	for (i = 0; af_stripes[i]; i++) {
+		split = malloc(AF_KEY_SIZE * af_stripes[i]);
+		if (!split)
+			return;
+
+		BENCH_LOOP(ops, ms, r, AF_split(key, split, AF_KEY_SIZE,
+						af_stripes[i], "sha1"));
+		if (r < 0)
+			_failed("af_split", "sha1", r);
+		else
+			_result("af_split", "sha1", af_stripes[i],
+				AF_KEY_SIZE * af_stripes[i], ops, ms);
+
+		BENCH_LOOP(ops, ms, r, AF_merge(split, key, AF_KEY_SIZE,
+						af_stripes[i], "sha1"));
+		if (r < 0)
+			_failed("af_merge", "sha1", r);
+		else
+			_result("af_merge", "sha1", af_stripes[i],
+				AF_KEY_SIZE * af_stripes[i], ops, ms);
+
+		free(split);
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [--time MS] [--json FILE] [--debug]\n", prog);
+	exit(1);
+}
+
+int main (int argc, char *argv[])
+{
+	char *buf;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp("--debug", argv[i]))
+			_debug = 1;
+		else if (!strcmp("--time", argv[i]) && i + 1 < argc)
+			_bench_ms = atoi(argv[++i]);
+		else if (!strcmp("--json", argv[i]) && i + 1 < argc)
+			_json_file = argv[++i];
+		else
+			usage(argv[0]);
+	}
+
+	if (_bench_ms < 1)
+		usage(argv[0]);
+
+	if (crypt_backend_init(NULL)) {
+		printf("Cannot initialise crypto backend %s.\n", CRYPTO_BACKEND);
+		return 1;
+	}
+
+	buf = malloc(MAX_MSG_SIZE);
+	if (!buf)
+		return 1;
+	memset(buf, 0xaa, MAX_MSG_SIZE);
+
+	if (_json_file) {
+		_json = fopen(_json_file, "w");
+		if (!_json) {
+			printf("Cannot write results to %s.\n", _json_file);
+			free(buf);
+			return 1;
+		}
+		fprintf(_json, "{\n  \"backend\": \"%s\",\n  \"kernel\": %s,\n"
+			"  \"results\": [\n", CRYPTO_BACKEND,
+			crypt_backend_flags() & CRYPT_BACKEND_KERNEL ? "true" : "false");
+	}
+
+	printf("# backend %s\n", CRYPTO_BACKEND);
+	printf("# %-12s %-10s %6s %10s %12s %10s\n",
+	       "test", "alg", "size", "ops", "us/op", "MiB/s");
+
+	HashBench(buf);
+	HmacBench(buf);
+	Pbkdf2Bench();
+	AfBench();
+
+	if (_json) {
+		fprintf(_json, "\n  ]\n}\n");
+		fclose(_json);
+	}
+
+	free(buf);
+	return 0;
+}